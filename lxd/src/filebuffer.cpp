@@ -0,0 +1,96 @@
+#include "fileio.h"
+#include "writebehind.h"
+#include <algorithm>
+
+// The write buffer of lxd::File, shared by both backends. They provide writeDirect, which
+// hands bytes to the system right away, plain or gathered. With a WriteBehind every write is
+// collected in the buffer, which a flush queues for the write-behind thread as a whole.
+namespace lxd {
+	bool File::write(const void* buffer, size_t bufferSize) {
+		if (_writer) {
+			auto bytes = static_cast<const char*>(buffer);
+			_buffer.insert(_buffer.end(), bytes, bytes + bufferSize);
+			return (_buffer.size() < _bufferSize) || flush();
+		}
+		if (_bufferSize == 0) {
+			return writeDirect(buffer, bufferSize);
+		}
+		if (_buffer.size() + bufferSize > _bufferSize && !flush()) {
+			return false;
+		}
+		// too large to be worth a copy
+		if (bufferSize >= _bufferSize) {
+			return writeDirect(buffer, bufferSize);
+		}
+		auto bytes = static_cast<const char*>(buffer);
+		_buffer.insert(_buffer.end(), bytes, bytes + bufferSize);
+		return true;
+	}
+
+	bool File::write(std::span<const std::string_view> pieces) {
+		size_t total = 0;
+		for (auto piece : pieces) {
+			total += piece.size();
+		}
+
+		if (_writer || (_bufferSize != 0 && _buffer.size() + total <= _bufferSize)) {
+			for (auto piece : pieces) {
+				_buffer.insert(_buffer.end(), piece.begin(), piece.end());
+			}
+			return (!_writer || _buffer.size() < _bufferSize) || flush();
+		}
+		if (_buffer.empty()) {
+			return writeDirect(pieces);
+		}
+
+		std::vector<std::string_view> gathered;
+		gathered.reserve(pieces.size() + 1);
+		gathered.emplace_back(_buffer.data(), _buffer.size());
+		gathered.insert(gathered.end(), pieces.begin(), pieces.end());
+		bool ok = writeDirect(gathered);
+		_buffer.clear();
+		return ok;
+	}
+
+	bool File::flush() {
+		if (_buffer.empty()) {
+			return true;
+		}
+		if (_writer) {
+			// the offset is settled here, so the caller can go on writing while the thread catches up
+			auto size = static_cast<long long>(_buffer.size());
+			_writer->submit(_handle, _offset, std::move(_buffer));
+			_offset += size;
+			_size = std::max(_size, _offset);
+			_buffer = _writer->acquire(_bufferSize);
+			return true;
+		}
+		bool ok = writeDirect(_buffer.data(), _buffer.size());
+		_buffer.clear();
+		return ok;
+	}
+
+	bool File::sync() {
+		bool ok = flush();
+		if (_writer) {
+			ok &= _writer->sync(_handle);
+		}
+		return ok;
+	}
+
+	bool File::setWriteBehind(WriteBehind* writer) {
+		bool ok = sync();
+		_writer = writer;
+		return ok;
+	}
+
+	bool File::setBufferSize(size_t size) {
+		bool ok = flush();
+		_bufferSize = size;
+		_buffer.reserve(size);
+		if (size == 0) {
+			_buffer.shrink_to_fit();
+		}
+		return ok;
+	}
+}
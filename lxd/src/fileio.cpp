@@ -5,6 +5,8 @@
 #include <fmt/format.h>
 #include <cassert>
 #include <fmt/xchar.h>
+#include <algorithm>
+#include <utility>
 
 namespace lxd {
 	bool FileExists(const wchar_t* path) {
@@ -76,6 +78,25 @@ namespace lxd {
 		return true;
 	}
 
+	bool WriteFileAt(void* handle, const void* buffer, size_t bufferSize, long long offset) {
+		// a synchronous handle writes at the offset of the OVERLAPPED and returns when done
+		auto bytes = static_cast<const char*>(buffer);
+		while (bufferSize > 0) {
+			OVERLAPPED overlapped = {};
+			overlapped.Offset = static_cast<DWORD>(offset);
+			overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			auto chunk = static_cast<DWORD>(std::min<size_t>(bufferSize, 1u << 30));
+			DWORD bytesWritten = 0;
+			if (!::WriteFile(handle, bytes, chunk, &bytesWritten, &overlapped) || bytesWritten == 0) {
+				return false;
+			}
+			bytes += bytesWritten;
+			bufferSize -= bytesWritten;
+			offset += bytesWritten;
+		}
+		return true;
+	}
+
 	std::string ReadFile(const wchar_t* path) {
 		// open the file
 		auto handle = OpenFile(path, OpenMode::ReadOnly | OpenMode::ExistingOnly);
@@ -88,12 +109,21 @@ namespace lxd {
 			CloseHandle(handle);
 			return {};
 		}
-		// read
+		// read, in chunks a DWORD can count
 		std::string buffer;
 		buffer.resize(size.QuadPart);
-		if (!::ReadFile(handle, buffer.data(), static_cast<DWORD>(buffer.size()), nullptr, nullptr)) {
-			CloseHandle(handle);
-			return {};
+		for (size_t offset = 0; offset < buffer.size();) {
+			auto chunk = static_cast<DWORD>(std::min<size_t>(buffer.size() - offset, 1u << 30));
+			DWORD read = 0;
+			if (!::ReadFile(handle, buffer.data() + offset, chunk, &read, nullptr)) {
+				CloseHandle(handle);
+				return {};
+			}
+			if (read == 0) {
+				buffer.resize(offset);
+				break;
+			}
+			offset += read;
 		}
 
 		CloseFile(handle);
@@ -246,7 +276,7 @@ namespace lxd {
 		return true;
 	}
 
-	File::File(const std::wstring& path, int mode) {
+	File::File(const std::wstring& path, int mode, size_t bufferSize) {
 		assert(path.size() > 3); // D:\\1
 		auto offset = path.find_last_of(L"\\");
 		if (offset != std::wstring::npos) {
@@ -258,29 +288,69 @@ namespace lxd {
 		// get file size
 		bool ok = GetFileSizeEx(_handle, reinterpret_cast<PLARGE_INTEGER>(&_size));
 		assert(ok);
+		_offset = (mode & OpenMode::Append) ? _size : 0;
+		setBufferSize(bufferSize);
 	}
 
 	File::~File() {
+		sync();
 		CloseFile(_handle);
 	}
 
 	bool File::seek(long long distance, SeekMode mode, long long* newPtr) {
+		if (!sync())
+			return false;
 		_LARGE_INTEGER _distance;
 		_distance.QuadPart = distance;
-		return SetFilePointerEx(_handle, _distance, reinterpret_cast<PLARGE_INTEGER>(newPtr), mode);
+		if (!SetFilePointerEx(_handle, _distance, reinterpret_cast<PLARGE_INTEGER>(&_offset), mode))
+			return false;
+		if (newPtr)
+			*newPtr = _offset;
+		return true;
 	}
 
 	bool File::read(void* buffer, unsigned long nNumberOfBytesToRead, unsigned long* lpNumberOfBytesRead) {
-		return ::ReadFile(_handle, buffer, nNumberOfBytesToRead, lpNumberOfBytesRead, nullptr);
+		if (!sync())
+			return false;
+		DWORD bytesRead = 0;
+		if (!::ReadFile(_handle, buffer, nNumberOfBytesToRead, &bytesRead, nullptr))
+			return false;
+		_offset += bytesRead;
+		if (lpNumberOfBytesRead)
+			*lpNumberOfBytesRead = bytesRead;
+		return true;
 	}
 
-	bool File::write(const void* buffer, size_t bufferSize) {
-		DWORD bytesWritten = 0;
-		if (::WriteFile(_handle, buffer, static_cast<DWORD>(bufferSize), &bytesWritten, nullptr)) {
-			_size += bytesWritten;
-			return true;
+	bool File::writeDirect(const void* buffer, size_t bufferSize) {
+		// in chunks a DWORD can count
+		auto bytes = static_cast<const char*>(buffer);
+		while (bufferSize > 0) {
+			auto chunk = static_cast<DWORD>(std::min<size_t>(bufferSize, 1u << 30));
+			DWORD bytesWritten = 0;
+			if (!::WriteFile(_handle, bytes, chunk, &bytesWritten, nullptr) || bytesWritten == 0) {
+				return false;
+			}
+			_offset += bytesWritten;
+			_size = std::max(_size, _offset);
+			bytes += bytesWritten;
+			bufferSize -= bytesWritten;
+		}
+		return true;
+	}
+
+	bool File::writeDirect(std::span<const std::string_view> pieces) {
+		// WriteFileGather wants unbuffered, page aligned io, so the pieces go one after the other
+		for (auto piece : pieces) {
+			if (!writeDirect(piece.data(), piece.size()))
+				return false;
 		}
-		return false;
+		return true;
+	}
+
+	bool File::preallocate(long long size) {
+		FILE_ALLOCATION_INFO info = {};
+		info.AllocationSize.QuadPart = size;
+		return SetFileInformationByHandle(_handle, FileAllocationInfo, &info, sizeof(info));
 	}
 
 	struct tm File::getLastWriteTime() {
@@ -312,4 +382,52 @@ namespace lxd {
 			lastWT.tm_sec < otherTM.tm_sec;
 	}
 
+
+	MappedFile::MappedFile(const std::wstring& path) {
+		auto handle = OpenFile(path.data(), OpenMode::ReadOnly | OpenMode::ExistingOnly);
+		if (INVALID_HANDLE_VALUE == handle) {
+			return;
+		}
+		LARGE_INTEGER size;
+		if (GetFileSizeEx(handle, &size)) {
+			_size = static_cast<size_t>(size.QuadPart);
+			// empty files can't be mapped
+			if (_size == 0) {
+				_open = true;
+			}
+			else if (auto mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr)) {
+				_data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				_open = (_data != nullptr);
+				// the view keeps the mapping and the file alive
+				CloseHandle(mapping);
+			}
+		}
+		CloseFile(handle);
+	}
+
+	MappedFile::~MappedFile() {
+		unmap();
+	}
+
+	MappedFile::MappedFile(MappedFile&& other) noexcept
+		: _data(std::exchange(other._data, nullptr)), _size(std::exchange(other._size, 0)), _open(std::exchange(other._open, false)) {}
+
+	MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+		if (this != &other) {
+			unmap();
+			_data = std::exchange(other._data, nullptr);
+			_size = std::exchange(other._size, 0);
+			_open = std::exchange(other._open, false);
+		}
+		return *this;
+	}
+
+	void MappedFile::unmap() {
+		if (_data) {
+			UnmapViewOfFile(_data);
+		}
+		_data = nullptr;
+		_size = 0;
+		_open = false;
+	}
 }
\ No newline at end of file
@@ -1,12 +1,17 @@
 #pragma once
 
 #include "defines.h"
+#include <algorithm>
+#include <cstddef>
+#include <span>
 #include <string_view>
 #include <vector>
 #include <string>
 #include <ctime>
 
 namespace lxd {
+	class WriteBehind;
+
 	enum OpenMode {
 		NotOpen = 0x0000,
 		ReadOnly = 0x0001,
@@ -30,6 +35,8 @@ namespace lxd {
 	DLL_PUBLIC void* OpenFile(const wchar_t* path, int mode);
 	DLL_PUBLIC bool CloseFile(void* handle);
 	DLL_PUBLIC bool WriteFile(const wchar_t* path, char const* buffer, size_t bufferSize);
+	// writes all of buffer to an open handle at offset
+	DLL_PUBLIC bool WriteFileAt(void* handle, const void* buffer, size_t bufferSize, long long offset);
 	DLL_PUBLIC std::string ReadFile(const wchar_t* path);
 	DLL_PUBLIC bool RemoveFile(const wchar_t* path);
 
@@ -41,16 +48,66 @@ namespace lxd {
 
 	class DLL_PUBLIC File {
 	public:
-		File(const std::wstring& path, int mode);
+		// with a bufferSize, writes smaller than the buffer are collected and written together
+		File(const std::wstring& path, int mode, size_t bufferSize = 0);
 		~File();
-		long long size() { return _size; }
+		// buffered bytes count where they will be written, past the end they grow the file
+		long long size() { return std::max(_size, _offset + static_cast<long long>(_buffer.size())); }
 		bool seek(long long distance, SeekMode mode, long long* newPtr = nullptr);
 		bool read(void* buffer, unsigned long nNumberOfBytesToRead, unsigned long* lpNumberOfBytesRead = nullptr);
 		bool write(const void* buffer, size_t size);
+		// writes the pieces in order with a single gathered write where the system has one,
+		// the buffered bytes go first in the same call
+		bool write(std::span<const std::string_view> pieces);
+		// hands the buffered bytes to the system, or to the write-behind thread, also done on close
+		bool flush();
+		// hands every flushed buffer to writer's thread instead of writing it on the caller's,
+		// nullptr writes synchronously again
+		bool setWriteBehind(WriteBehind* writer);
+		// flushes and waits until the write-behind thread wrote everything, false if a write failed
+		bool sync();
+		// flushes and changes the buffer size, 0 turns buffering off
+		bool setBufferSize(size_t size);
+		// reserves disk space for size bytes up front without changing the file size
+		bool preallocate(long long size);
 		struct tm getLastWriteTime();
 		bool isOlderThan(struct tm);
+	private:
+		bool writeDirect(const void* buffer, size_t size);
+		bool writeDirect(std::span<const std::string_view> pieces);
 	private:
 		void* _handle{};
 		long long _size{};
+		// the position read and written next, the POSIX backend reads and writes there with pread/pwrite,
+		// the write-behind thread at the offset each buffer was given when it was queued
+		long long _offset{};
+		std::vector<char> _buffer;
+		size_t _bufferSize{};
+		WriteBehind* _writer{};
+	};
+
+	// A whole file mapped read-only, the views stay valid for the lifetime of the MappedFile.
+	// Parsers read straight from the page cache instead of a copy, for files of any size
+	class DLL_PUBLIC MappedFile {
+	public:
+		explicit MappedFile(const std::wstring& path);
+		~MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile(MappedFile&& other) noexcept;
+		MappedFile& operator=(MappedFile&& other) noexcept;
+
+		// false when the file couldn't be opened or mapped, an empty file is open with size 0
+		bool isOpen() const { return _open; }
+		size_t size() const { return _size; }
+		const std::byte* data() const { return static_cast<const std::byte*>(_data); }
+		std::span<const std::byte> bytes() const { return { data(), _size }; }
+		std::string_view view() const { return { static_cast<const char*>(_data), _size }; }
+	private:
+		void unmap();
+	private:
+		void* _data{};
+		size_t _size{};
+		bool _open{};
 	};
 }
\ No newline at end of file
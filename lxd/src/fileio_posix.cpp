@@ -0,0 +1,495 @@
+#include "fileio.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <climits>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cwchar>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+
+// POSIX counterpart of fileio.cpp. Handles are file descriptors cast to void*, so an invalid one
+// compares equal to INVALID_HANDLE_VALUE on Windows. Reads and writes are positional (pread/pwrite),
+// File keeps its own offset and never moves the descriptor's.
+namespace lxd {
+	static void* const InvalidHandle = reinterpret_cast<void*>(static_cast<intptr_t>(-1));
+
+	static int toFd(void* handle) {
+		return static_cast<int>(reinterpret_cast<intptr_t>(handle));
+	}
+
+	static void* toHandle(int fd) {
+		return reinterpret_cast<void*>(static_cast<intptr_t>(fd));
+	}
+
+	// the file system takes UTF-8, wchar_t holds UTF-32 here
+	static std::string toNative(std::wstring_view path) {
+		std::string result;
+		result.reserve(path.size());
+		for (auto ch : path) {
+			auto cp = static_cast<uint32_t>(ch);
+			if (cp < 0x80) {
+				result += static_cast<char>(cp);
+			}
+			else if (cp < 0x800) {
+				result += static_cast<char>(0xC0 | (cp >> 6));
+				result += static_cast<char>(0x80 | (cp & 0x3F));
+			}
+			else if (cp < 0x10000) {
+				result += static_cast<char>(0xE0 | (cp >> 12));
+				result += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+				result += static_cast<char>(0x80 | (cp & 0x3F));
+			}
+			else {
+				result += static_cast<char>(0xF0 | (cp >> 18));
+				result += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+				result += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+				result += static_cast<char>(0x80 | (cp & 0x3F));
+			}
+		}
+		return result;
+	}
+
+	static std::wstring fromNative(std::string_view name) {
+		std::wstring result;
+		result.reserve(name.size());
+		for (size_t i = 0; i < name.size();) {
+			auto byte = static_cast<unsigned char>(name[i]);
+			int length = (byte < 0x80) ? 1 : (byte < 0xE0) ? 2 : (byte < 0xF0) ? 3 : 4;
+			uint32_t cp = (length == 1) ? byte : byte & (0x3F >> (length - 1));
+			for (int k = 1; k < length && i + k < name.size(); k++)
+				cp = (cp << 6) | (static_cast<unsigned char>(name[i + k]) & 0x3F);
+			result += static_cast<wchar_t>(cp);
+			i += length;
+		}
+		return result;
+	}
+
+	// full transfers, retried on EINTR and short counts
+	static bool preadAll(int fd, void* buffer, size_t size, long long offset, size_t* transferred) {
+		size_t done = 0;
+		while (done < size) {
+			auto n = ::pread(fd, static_cast<char*>(buffer) + done, size - done, offset + done);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0) {
+				*transferred = done;
+				return false;
+			}
+			if (n == 0)
+				break;
+			done += n;
+		}
+		*transferred = done;
+		return true;
+	}
+
+	static bool pwriteAll(int fd, const void* buffer, size_t size, long long offset) {
+		size_t done = 0;
+		while (done < size) {
+			auto n = ::pwrite(fd, static_cast<const char*>(buffer) + done, size - done, offset + done);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			done += n;
+		}
+		return true;
+	}
+
+	// reserves the blocks without changing the size, a no-op where the file system can't
+	static bool reserveBlocks(int fd, long long size) {
+		// nothing to reserve, fallocate rejects a zero length with EINVAL
+		if (size <= 0)
+			return true;
+#ifdef __linux__
+		if (::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) == 0)
+			return true;
+		return errno == EOPNOTSUPP || errno == ENOSYS;
+#else
+		(void)fd;
+		(void)size;
+		return true;
+#endif
+	}
+
+	bool FileExists(const wchar_t* path) {
+		struct stat info;
+		return ::stat(toNative(path).c_str(), &info) == 0;
+	}
+
+	bool openModeCanCreate(int openMode) {
+		// WriteOnly can create, but only when ExistingOnly isn't specified.
+		// ReadOnly by itself never creates.
+		return (openMode & OpenMode::WriteOnly) && !(openMode & OpenMode::ExistingOnly);
+	}
+
+	void* OpenFile(const wchar_t* path, int openMode) {
+		int flags = O_CLOEXEC;
+		if ((openMode & OpenMode::ReadWrite) == OpenMode::ReadWrite)
+			flags |= O_RDWR;
+		else if (openMode & OpenMode::WriteOnly)
+			flags |= O_WRONLY;
+		else
+			flags |= O_RDONLY;
+		// WriteOnly can create files, ReadOnly cannot.
+		if (openMode & OpenMode::NewOnly)
+			flags |= O_CREAT | O_EXCL;
+		else if (openModeCanCreate(openMode))
+			flags |= O_CREAT;
+		if ((openMode & OpenMode::Truncate) && !(openMode & OpenMode::Append) && (openMode & OpenMode::WriteOnly))
+			flags |= O_TRUNC;
+
+		int fd;
+		do {
+			fd = ::open(toNative(path).c_str(), flags, 0666);
+		} while (fd < 0 && errno == EINTR);
+		if (fd < 0)
+			return InvalidHandle;
+
+		// for callers of the raw handle, File keeps its own offset
+		if (openMode & OpenMode::Append)
+			::lseek(fd, 0, SEEK_END);
+		if (openMode & OpenMode::ReadOnly)
+			::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+		return toHandle(fd);
+	}
+
+	bool CloseFile(void* handle) {
+		return ::close(toFd(handle)) == 0;
+	}
+
+	bool WriteFile(const wchar_t* path, char const* buffer, size_t bufferSize) {
+		// open the file
+		auto handle = OpenFile(path, OpenMode::WriteOnly | OpenMode::Truncate);
+		if (InvalidHandle == handle) {
+			return false;
+		}
+		// reserve the blocks in one go, then write
+		auto fd = toFd(handle);
+		if (!reserveBlocks(fd, bufferSize) || !pwriteAll(fd, buffer, bufferSize, 0)) {
+			CloseFile(handle);
+			return false;
+		}
+		return CloseFile(handle);
+	}
+
+	bool WriteFileAt(void* handle, const void* buffer, size_t bufferSize, long long offset) {
+		return pwriteAll(toFd(handle), buffer, bufferSize, offset);
+	}
+
+	std::string ReadFile(const wchar_t* path) {
+		// open the file
+		auto handle = OpenFile(path, OpenMode::ReadOnly | OpenMode::ExistingOnly);
+		if (InvalidHandle == handle) {
+			return {};
+		}
+		// get file size
+		auto fd = toFd(handle);
+		struct stat info;
+		if (::fstat(fd, &info) != 0) {
+			CloseFile(handle);
+			return {};
+		}
+		// read, any size
+		std::string buffer;
+		buffer.resize(info.st_size);
+		size_t read = 0;
+		if (!preadAll(fd, buffer.data(), buffer.size(), 0, &read)) {
+			CloseFile(handle);
+			return {};
+		}
+		buffer.resize(read);
+
+		CloseFile(handle);
+		return buffer;
+	}
+
+	bool RemoveFile(const wchar_t* path) {
+		return ::unlink(toNative(path).c_str()) == 0;
+	}
+
+	bool CreateDir(const wchar_t* path) {
+		return ::mkdir(toNative(path).c_str(), 0777) == 0;
+	}
+
+	bool CreateDirRecursive(const std::wstring& path) {
+		if (DirExists(path)) {
+			return true;
+		}
+
+		size_t i = path.find_last_of(L"/");
+		if (i == std::wstring_view::npos) {
+			return CreateDir(path.data());
+		}
+
+		if (i > 0 && !CreateDirRecursive(path.substr(0, i))) {
+			return false;
+		}
+
+		return CreateDir(path.data()) || DirExists(path);
+	}
+
+	int DeleteDir(std::wstring_view path, bool bDeleteSubdirectories) {
+		auto nativePath = toNative(path);
+		DIR* dir = ::opendir(nativePath.c_str());
+		if (!dir)
+			return 0;
+
+		bool bSubdirectory = false; // Flag, indicating whether subdirectories have been found
+		int error = 0;
+		while (auto entry = ::readdir(dir)) {
+			if (entry->d_name[0] == '.')
+				continue;
+
+			auto entryPath = nativePath + "/" + entry->d_name;
+			struct stat info;
+			if (::lstat(entryPath.c_str(), &info) != 0) {
+				error = errno;
+				break;
+			}
+
+			if (S_ISDIR(info.st_mode)) {
+				if (bDeleteSubdirectories) {
+					// Delete subdirectory
+					error = DeleteDir(fromNative(entryPath), bDeleteSubdirectories);
+					if (error)
+						break;
+				}
+				else
+					bSubdirectory = true;
+			}
+			else if (::unlink(entryPath.c_str()) != 0) {
+				error = errno;
+				break;
+			}
+		}
+		::closedir(dir);
+
+		if (!error && !bSubdirectory && ::rmdir(nativePath.c_str()) != 0)
+			error = errno;
+		return error;
+	}
+
+	bool DirExists(std::wstring_view path) {
+		struct stat info;
+		return ::stat(toNative(path).c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+	}
+
+	// names are relative to the directory listed first, prefix holds the part walked so far
+	static bool listDir(const std::string& path, const std::wstring& prefix, std::vector<std::wstring>& result, bool recursive, const wchar_t* filter) {
+		DIR* dir = ::opendir(path.c_str());
+		if (!dir) {
+			return false;
+		}
+
+		auto lenFilter = filter ? std::wcslen(filter) : 0;
+		while (auto entry = ::readdir(dir)) {
+			if (!strcmp(".", entry->d_name) || !strcmp("..", entry->d_name)) {
+				continue;
+			}
+
+			auto entryPath = path + "/" + entry->d_name;
+			bool isDir = (entry->d_type == DT_DIR);
+			if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+				struct stat info;
+				isDir = ::stat(entryPath.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+			}
+
+			auto name = prefix.empty() ? fromNative(entry->d_name) : prefix + L"/" + fromNative(entry->d_name);
+			if (isDir) {
+				if (recursive) {
+					listDir(entryPath, name, result, recursive, filter);
+				}
+			}
+			else if (nullptr == filter) {
+				result.push_back(std::move(name));
+			}
+			else if (lenFilter < name.size() && ::wcscasecmp(filter, name.c_str() + (name.size() - lenFilter)) == 0) {
+				result.push_back(std::move(name));
+			}
+		}
+
+		::closedir(dir);
+		return true;
+	}
+
+	bool ListDir(std::wstring_view path, std::vector<std::wstring>& result, bool recursive, const wchar_t* filter) {
+		return listDir(toNative(path), {}, result, recursive, filter);
+	}
+
+	File::File(const std::wstring& path, int mode, size_t bufferSize) {
+		assert(!path.empty());
+		auto offset = path.find_last_of(L"/");
+		if (offset != std::wstring::npos && offset > 0) {
+			auto middleDir = path.substr(0, offset);
+			CreateDirRecursive(middleDir);
+		}
+		_handle = OpenFile(path.data(), mode);
+		assert(InvalidHandle != _handle);
+		// get file size
+		struct stat info;
+		bool ok = ::fstat(toFd(_handle), &info) == 0;
+		assert(ok);
+		_size = ok ? info.st_size : 0;
+		_offset = (mode & OpenMode::Append) ? _size : 0;
+		setBufferSize(bufferSize);
+	}
+
+	File::~File() {
+		sync();
+		CloseFile(_handle);
+	}
+
+	bool File::seek(long long distance, SeekMode mode, long long* newPtr) {
+		if (!sync())
+			return false;
+		long long base = (mode == FileBegin) ? 0 : (mode == FileCurrent) ? _offset : _size;
+		if (base + distance < 0)
+			return false;
+		_offset = base + distance;
+		if (newPtr)
+			*newPtr = _offset;
+		return true;
+	}
+
+	bool File::read(void* buffer, unsigned long nNumberOfBytesToRead, unsigned long* lpNumberOfBytesRead) {
+		if (!sync())
+			return false;
+		size_t read = 0;
+		bool ok = preadAll(toFd(_handle), buffer, nNumberOfBytesToRead, _offset, &read);
+		_offset += read;
+		if (lpNumberOfBytesRead)
+			*lpNumberOfBytesRead = static_cast<unsigned long>(read);
+		return ok;
+	}
+
+	bool File::writeDirect(const void* buffer, size_t bufferSize) {
+		if (!pwriteAll(toFd(_handle), buffer, bufferSize, _offset))
+			return false;
+		_offset += bufferSize;
+		_size = std::max(_size, _offset);
+		return true;
+	}
+
+	bool File::writeDirect(std::span<const std::string_view> pieces) {
+		std::vector<iovec> vectors;
+		vectors.reserve(pieces.size());
+		for (auto piece : pieces) {
+			if (!piece.empty())
+				vectors.push_back({ const_cast<char*>(piece.data()), piece.size() });
+		}
+
+		auto fd = toFd(_handle);
+		size_t first = 0;
+		while (first < vectors.size()) {
+			auto count = static_cast<int>(std::min<size_t>(vectors.size() - first, IOV_MAX));
+			auto n = ::pwritev(fd, vectors.data() + first, count, _offset);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			_offset += n;
+			_size = std::max(_size, _offset);
+
+			// skip what was written, a short write leaves the rest of a vector
+			for (size_t written = n; written > 0 && first < vectors.size();) {
+				auto& vector = vectors[first];
+				if (written >= vector.iov_len) {
+					written -= vector.iov_len;
+					first++;
+				}
+				else {
+					vector.iov_base = static_cast<char*>(vector.iov_base) + written;
+					vector.iov_len -= written;
+					written = 0;
+				}
+			}
+		}
+		return true;
+	}
+
+	bool File::preallocate(long long size) {
+		return reserveBlocks(toFd(_handle), size);
+	}
+
+	struct tm File::getLastWriteTime() {
+		struct stat info;
+		bool ok = ::fstat(toFd(_handle), &info) == 0;
+		assert(ok);
+
+		// Convert the last-write time to local time.
+		struct tm local = {};
+		if (ok)
+			::localtime_r(&info.st_mtime, &local);
+		return local;
+	}
+
+	bool File::isOlderThan(struct tm otherTM) {
+		tm lastWT = getLastWriteTime();
+		return lastWT.tm_year < otherTM.tm_year ||
+			lastWT.tm_mon < otherTM.tm_mon ||
+			lastWT.tm_mday < otherTM.tm_mday ||
+			lastWT.tm_hour < otherTM.tm_hour ||
+			lastWT.tm_min < otherTM.tm_min ||
+			lastWT.tm_sec < otherTM.tm_sec;
+	}
+
+	MappedFile::MappedFile(const std::wstring& path) {
+		auto handle = OpenFile(path.data(), OpenMode::ReadOnly | OpenMode::ExistingOnly);
+		if (InvalidHandle == handle) {
+			return;
+		}
+		auto fd = toFd(handle);
+		struct stat info;
+		if (::fstat(fd, &info) == 0) {
+			_size = static_cast<size_t>(info.st_size);
+			// mmap refuses empty mappings
+			if (_size == 0) {
+				_open = true;
+			}
+			else {
+				auto data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (data != MAP_FAILED) {
+					_data = data;
+					_open = true;
+				}
+			}
+		}
+		// the mapping keeps the file alive
+		CloseFile(handle);
+	}
+
+	MappedFile::~MappedFile() {
+		unmap();
+	}
+
+	MappedFile::MappedFile(MappedFile&& other) noexcept
+		: _data(std::exchange(other._data, nullptr)), _size(std::exchange(other._size, 0)), _open(std::exchange(other._open, false)) {}
+
+	MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+		if (this != &other) {
+			unmap();
+			_data = std::exchange(other._data, nullptr);
+			_size = std::exchange(other._size, 0);
+			_open = std::exchange(other._open, false);
+		}
+		return *this;
+	}
+
+	void MappedFile::unmap() {
+		if (_data) {
+			::munmap(_data, _size);
+		}
+		_data = nullptr;
+		_size = 0;
+		_open = false;
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "defines.h"
+#include <string>
+#include <string_view>
+
+namespace lxd {
+	// One end of a unix domain stream socket, closed when destroyed. Messages go over it as frames:
+	// a 4 byte little endian length, then that many bytes
+	class DLL_PUBLIC LocalSocket {
+	public:
+		LocalSocket() = default;
+		explicit LocalSocket(int fd) : _fd(fd) {}
+		~LocalSocket();
+		LocalSocket(LocalSocket&& other) noexcept;
+		LocalSocket& operator=(LocalSocket&& other) noexcept;
+		LocalSocket(const LocalSocket&) = delete;
+		LocalSocket& operator=(const LocalSocket&) = delete;
+
+		// an unopened socket when nobody listens on path
+		static LocalSocket connect(const std::string& path);
+
+		bool isOpen() const { return _fd >= 0; }
+		// false once the other end hung up or the frame is larger than maxSize
+		bool readFrame(std::string& frame, size_t maxSize = 1 << 30);
+		bool writeFrame(std::string_view frame);
+		// ends both directions, a read blocked on another thread returns false
+		void shutdown();
+
+	private:
+		int _fd = -1;
+	};
+
+	// Listens on a unix domain socket path, which is replaced if it exists and removed again on close
+	class DLL_PUBLIC LocalServer {
+	public:
+		explicit LocalServer(const std::string& path);
+		~LocalServer();
+		LocalServer(const LocalServer&) = delete;
+		LocalServer& operator=(const LocalServer&) = delete;
+
+		bool isOpen() const { return _fd >= 0; }
+		// waits for the next client, an unopened socket once the server is closed
+		LocalSocket accept();
+		// may be called from any thread, wakes a waiting accept
+		void close();
+
+	private:
+		std::string _path;
+		int _fd = -1;
+	};
+}
@@ -0,0 +1,138 @@
+#include "localsocket.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+namespace lxd {
+	static bool fillAddress(const std::string& path, sockaddr_un& address) {
+		std::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(address.sun_path))
+			return false;
+		std::memcpy(address.sun_path, path.data(), path.size());
+		return true;
+	}
+
+	static bool readAll(int fd, char* data, size_t size) {
+		while (size > 0) {
+			auto count = ::read(fd, data, size);
+			if (count < 0 && errno == EINTR)
+				continue;
+			if (count <= 0)
+				return false;
+			data += count;
+			size -= static_cast<size_t>(count);
+		}
+		return true;
+	}
+
+	static bool writeAll(int fd, const char* data, size_t size) {
+		while (size > 0) {
+			// no SIGPIPE when the client is gone, the write just fails
+			auto count = ::send(fd, data, size, MSG_NOSIGNAL);
+			if (count < 0 && errno == EINTR)
+				continue;
+			if (count <= 0)
+				return false;
+			data += count;
+			size -= static_cast<size_t>(count);
+		}
+		return true;
+	}
+
+	LocalSocket::~LocalSocket() {
+		if (_fd >= 0)
+			::close(_fd);
+	}
+
+	LocalSocket::LocalSocket(LocalSocket&& other) noexcept : _fd(other._fd) {
+		other._fd = -1;
+	}
+
+	LocalSocket& LocalSocket::operator=(LocalSocket&& other) noexcept {
+		if (this != &other) {
+			if (_fd >= 0)
+				::close(_fd);
+			_fd = other._fd;
+			other._fd = -1;
+		}
+		return *this;
+	}
+
+	LocalSocket LocalSocket::connect(const std::string& path) {
+		sockaddr_un address;
+		if (!fillAddress(path, address))
+			return LocalSocket();
+		LocalSocket socket(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+		if (socket.isOpen() && ::connect(socket._fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+			return LocalSocket();
+		return socket;
+	}
+
+	bool LocalSocket::readFrame(std::string& frame, size_t maxSize) {
+		unsigned char header[4];
+		if (!readAll(_fd, reinterpret_cast<char*>(header), sizeof(header)))
+			return false;
+		size_t size = header[0] | (header[1] << 8) | (header[2] << 16) | (static_cast<size_t>(header[3]) << 24);
+		if (size > maxSize)
+			return false;
+		frame.resize(size);
+		return readAll(_fd, frame.data(), size);
+	}
+
+	bool LocalSocket::writeFrame(std::string_view frame) {
+		if (frame.size() > 0xffffffffu)
+			return false;
+		auto size = static_cast<uint32_t>(frame.size());
+		char header[4] = { char(size), char(size >> 8), char(size >> 16), char(size >> 24) };
+		return writeAll(_fd, header, sizeof(header)) && writeAll(_fd, frame.data(), frame.size());
+	}
+
+	void LocalSocket::shutdown() {
+		if (_fd >= 0)
+			::shutdown(_fd, SHUT_RDWR);
+	}
+
+	LocalServer::LocalServer(const std::string& path) : _path(path) {
+		sockaddr_un address;
+		if (!fillAddress(path, address))
+			return;
+		// a socket file left behind by a server that didn't shut down cleanly
+		::unlink(path.c_str());
+		_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (_fd < 0)
+			return;
+		if (::bind(_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(_fd, SOMAXCONN) != 0) {
+			::close(_fd);
+			_fd = -1;
+		}
+	}
+
+	LocalServer::~LocalServer() {
+		close();
+		if (_fd >= 0) {
+			::close(_fd);
+			::unlink(_path.c_str());
+		}
+	}
+
+	LocalSocket LocalServer::accept() {
+		while (_fd >= 0) {
+			auto fd = ::accept4(_fd, nullptr, nullptr, SOCK_CLOEXEC);
+			if (fd >= 0)
+				return LocalSocket(fd);
+			// a client that gave up before it was accepted, anything else means the listener is shut down or broken
+			if (errno != EINTR && errno != ECONNABORTED && errno != EPROTO)
+				break;
+		}
+		return LocalSocket();
+	}
+
+	void LocalServer::close() {
+		if (_fd >= 0)
+			::shutdown(_fd, SHUT_RDWR);
+	}
+}
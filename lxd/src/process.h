@@ -0,0 +1,33 @@
+#pragma once
+
+#include "defines.h"
+#include <chrono>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace lxd {
+	struct ProcessResult {
+		// -1 when the program couldn't be started or didn't exit normally
+		int exitCode = -1;
+		// everything the program wrote to its stdout
+		std::string output;
+		// the program was killed for running past the timeout, or for a requested stop
+		bool timedOut = false;
+		bool stopped = false;
+	};
+
+	struct ProcessOptions {
+		// the program is killed once it runs longer, 0 waits for as long as it takes
+		std::chrono::milliseconds timeout{};
+		// the program is killed as soon as a stop is requested
+		std::stop_token stop;
+	};
+
+	// Runs args[0] with the rest of args, found on PATH, and waits for it. Every input is handed
+	// over in memory: the child gets one more argument per input, a /dev/fd path it reads the input
+	// from, and no file is created on disk. stdin is /dev/null. POSIX only, the inputs are memfds
+	DLL_PUBLIC ProcessResult RunProcess(const std::vector<std::string>& args, std::span<const std::string_view> inputs = {}, const ProcessOptions& options = {});
+}
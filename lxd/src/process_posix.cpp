@@ -0,0 +1,146 @@
+#include "process.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <cerrno>
+
+extern char** environ;
+
+// posix_spawn keeps the child from copying the parent's page tables the way fork would. All
+// descriptors are opened close-on-exec, the spawn's file actions dup the ones the child needs,
+// so a process spawned concurrently by another thread doesn't inherit them
+namespace lxd {
+	static bool writeAll(int fd, std::string_view data) {
+		while (!data.empty()) {
+			auto written = ::write(fd, data.data(), data.size());
+			if (written < 0) {
+				if (errno == EINTR)
+					continue;
+				return false;
+			}
+			data.remove_prefix(static_cast<size_t>(written));
+		}
+		return true;
+	}
+
+	static void closeAll(const std::vector<int>& fds) {
+		for (auto fd : fds) {
+			if (fd >= 0)
+				::close(fd);
+		}
+	}
+
+	ProcessResult RunProcess(const std::vector<std::string>& args, std::span<const std::string_view> inputs, const ProcessOptions& options) {
+		ProcessResult result;
+		if (args.empty())
+			return result;
+		if (options.stop.stop_requested()) {
+			result.stopped = true;
+			return result;
+		}
+
+		// the inputs, then both ends of the stdout pipe
+		std::vector<int> fds;
+		for (auto input : inputs) {
+			auto fd = memfd_create("lxd-input", MFD_CLOEXEC);
+			fds.push_back(fd);
+			if (fd < 0 || !writeAll(fd, input)) {
+				closeAll(fds);
+				return result;
+			}
+		}
+		int out[2];
+		if (pipe2(out, O_CLOEXEC) != 0) {
+			closeAll(fds);
+			return result;
+		}
+		fds.push_back(out[0]);
+		fds.push_back(out[1]);
+
+		// the inputs land above every descriptor involved, so no dup2 overwrites a source still to come
+		auto base = std::max(*std::max_element(fds.begin(), fds.end()), 2) + 1;
+		posix_spawn_file_actions_t actions;
+		posix_spawn_file_actions_init(&actions);
+		posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+		posix_spawn_file_actions_adddup2(&actions, out[1], 1);
+		std::vector<std::string> paths;
+		for (size_t i = 0; i < inputs.size(); i++) {
+			auto target = base + static_cast<int>(i);
+			posix_spawn_file_actions_adddup2(&actions, fds[i], target);
+			paths.push_back("/dev/fd/" + std::to_string(target));
+		}
+
+		std::vector<char*> argv;
+		for (auto& arg : args)
+			argv.push_back(const_cast<char*>(arg.c_str()));
+		for (auto& path : paths)
+			argv.push_back(path.data());
+		argv.push_back(nullptr);
+
+		// a group of its own, so a kill reaches whatever the program started itself and holds the pipe open
+		posix_spawnattr_t attributes;
+		posix_spawnattr_init(&attributes);
+		posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+		posix_spawnattr_setpgroup(&attributes, 0);
+
+		pid_t pid = 0;
+		auto error = posix_spawnp(&pid, argv[0], &actions, &attributes, argv.data(), environ);
+		posix_spawn_file_actions_destroy(&actions);
+		posix_spawnattr_destroy(&attributes);
+		// the child holds its own copies now, the read end stays to collect the output
+		fds.pop_back();
+		fds.pop_back();
+		closeAll(fds);
+		::close(out[1]);
+		if (error != 0) {
+			::close(out[0]);
+			return result;
+		}
+
+		{
+			// a killed child closes its stdout as well, so the loop ends on EOF either way. The callback is
+			// gone before waitpid, it never signals a pid the system may already have handed out again
+			std::stop_callback onStop(options.stop, [&]() {
+				result.stopped = true;
+				::kill(-pid, SIGKILL);
+			});
+			auto deadline = std::chrono::steady_clock::now() + options.timeout;
+			char buffer[64 * 1024];
+			while (true) {
+				if (options.timeout.count() > 0 && !result.timedOut) {
+					auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+					pollfd ready = { out[0], POLLIN, 0 };
+					auto polled = (left.count() > 0) ? ::poll(&ready, 1, static_cast<int>(left.count())) : 0;
+					if (polled < 0 && errno == EINTR)
+						continue;
+					if (polled == 0) {
+						result.timedOut = true;
+						::kill(-pid, SIGKILL);
+						continue;
+					}
+				}
+				auto count = ::read(out[0], buffer, sizeof(buffer));
+				if (count < 0 && errno == EINTR)
+					continue;
+				if (count <= 0)
+					break;
+				result.output.append(buffer, static_cast<size_t>(count));
+			}
+		}
+		::close(out[0]);
+
+		int status = 0;
+		while (waitpid(pid, &status, 0) < 0) {
+			if (errno != EINTR)
+				return result;
+		}
+		if (WIFEXITED(status) && !result.timedOut && !result.stopped)
+			result.exitCode = WEXITSTATUS(status);
+		return result;
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <vector>
+
+namespace lxd {
+	// Bounded queue between exactly one producer thread and one consumer thread, without locks. Both ends
+	// only touch their own index and a cached copy of the other one, so an uncontended push or pop is a
+	// load and a store. push waits while the ring is full and pop while it is empty, a full ring is how a
+	// slow consumer holds its producer back.
+	template <typename T>
+	class SpscRing {
+	public:
+		// capacity is rounded up to a power of two
+		explicit SpscRing(size_t capacity)
+			: _slots(std::bit_ceil(std::max<size_t>(capacity, 1))), _mask(_slots.size() - 1) {}
+		SpscRing(const SpscRing&) = delete;
+		SpscRing& operator=(const SpscRing&) = delete;
+
+		size_t capacity() const { return _slots.size(); }
+
+		// producer only, value is moved from only when there was room
+		bool tryPush(T& value) {
+			auto tail = _tail.load(std::memory_order_relaxed);
+			if (tail - _headCache == _slots.size()) {
+				_headCache = _head.load(std::memory_order_acquire);
+				if (tail - _headCache == _slots.size())
+					return false;
+			}
+			_slots[tail & _mask] = std::move(value);
+			_tail.store(tail + 1, std::memory_order_release);
+			_tail.notify_one();
+			return true;
+		}
+
+		void push(T value) {
+			while (!tryPush(value)) {
+				auto head = _head.load(std::memory_order_acquire);
+				if (_tail.load(std::memory_order_relaxed) - head == _slots.size())
+					_head.wait(head, std::memory_order_acquire);
+			}
+		}
+
+		// consumer only
+		bool tryPop(T& value) {
+			auto head = _head.load(std::memory_order_relaxed);
+			if (head == _tailCache) {
+				_tailCache = _tail.load(std::memory_order_acquire);
+				if (head == _tailCache)
+					return false;
+			}
+			value = std::move(_slots[head & _mask]);
+			_head.store(head + 1, std::memory_order_release);
+			_head.notify_one();
+			return true;
+		}
+
+		T pop() {
+			T value;
+			while (!tryPop(value)) {
+				auto tail = _tail.load(std::memory_order_acquire);
+				if (tail == _head.load(std::memory_order_relaxed))
+					_tail.wait(tail, std::memory_order_acquire);
+			}
+			return value;
+		}
+
+	private:
+		std::vector<T> _slots;
+		size_t _mask;
+		// the consumer's line
+		alignas(64) std::atomic<size_t> _head{};
+		size_t _tailCache = 0;
+		// the producer's line
+		alignas(64) std::atomic<size_t> _tail{};
+		size_t _headCache = 0;
+	};
+}
@@ -3,24 +3,25 @@
 #include <assert.h>
 #include <algorithm>
 #include <cctype>
+#include <cwctype>
 
 namespace lxd {
 	void Upper(std::string& str) {
-		std::transform(str.begin(), str.end(), str.begin(), std::toupper);
+		std::transform(str.begin(), str.end(), str.begin(), ::toupper);
 	}
 	void Upper(std::wstring& str) {
-		std::transform(str.begin(), str.end(), str.begin(), std::toupper);
+		std::transform(str.begin(), str.end(), str.begin(), ::towupper);
 	}
 	void Lower(std::string& str) {
-		std::transform(str.begin(), str.end(), str.begin(), std::tolower);
+		std::transform(str.begin(), str.end(), str.begin(), ::tolower);
 	}
 	void Lower(std::wstring& str) {
-		std::transform(str.begin(), str.end(), str.begin(), std::tolower);
+		std::transform(str.begin(), str.end(), str.begin(), ::towlower);
 	}
 
 	std::string Lower(std::string_view str) {
 		std::string result(str);
-		std::transform(result.begin(), result.end(), result.begin(), std::tolower);
+		std::transform(result.begin(), result.end(), result.begin(), ::tolower);
 		return result;
 	}
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "defines.h"
+#include <string>
 #include <vector>
 #include <string_view>
 
@@ -0,0 +1,146 @@
+#include "threadpool.h"
+#include <algorithm>
+#include <exception>
+
+namespace lxd {
+	// the pool and queue owned by the current thread, if it is a worker
+	static thread_local ThreadPool* currentPool = nullptr;
+	static thread_local size_t currentQueue = 0;
+
+	ThreadPool::ThreadPool(size_t threadCount) {
+		threadCount = std::max<size_t>(threadCount, 1);
+		for (size_t i = 0; i < threadCount; i++)
+			_queues.push_back(std::make_unique<Queue>());
+		for (size_t i = 0; i < threadCount; i++)
+			_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+
+	ThreadPool::~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(_sleepMutex);
+			_stop = true;
+		}
+		_wake.notify_all();
+		for (auto& worker : _workers)
+			worker.join();
+	}
+
+	void ThreadPool::submit(std::function<void()> task) {
+		// workers keep their own tasks local, everybody else queues them in the shared injection queue
+		auto& queue = (currentPool == this) ? *_queues[currentQueue] : _injected;
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.tasks.push_back(std::move(task));
+		}
+		_pending++;
+		// take the sleep lock so a worker can't miss the wakeup between its check and its wait
+		{ std::lock_guard<std::mutex> lock(_sleepMutex); }
+		_wake.notify_one();
+	}
+
+	void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& func) {
+		if (count == 0)
+			return;
+
+		auto chunks = std::min(count, _workers.size() * 4);
+		std::atomic<size_t> remaining(chunks);
+		std::exception_ptr error;
+		std::mutex errorMutex;
+
+		for (size_t chunk = 0; chunk < chunks; chunk++) {
+			auto begin = count * chunk / chunks, end = count * (chunk + 1) / chunks;
+			submit([&, begin, end]() {
+				try {
+					for (auto i = begin; i < end; i++)
+						func(i);
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> lock(errorMutex);
+					if (!error)
+						error = std::current_exception();
+				}
+				// the last chunk wakes the caller, which may be asleep on _wake
+				if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					{ std::lock_guard<std::mutex> lock(_sleepMutex); }
+					_wake.notify_all();
+				}
+			});
+		}
+
+		// help instead of blocking, the caller may itself be a worker. Once nothing is queued the
+		// remaining chunks run on other threads, sleep until they finish or new tasks come in
+		while (remaining.load(std::memory_order_acquire) > 0) {
+			if (runPendingTask())
+				continue;
+			std::unique_lock<std::mutex> lock(_sleepMutex);
+			_wake.wait(lock, [&]() { return remaining.load(std::memory_order_acquire) == 0 || _pending > 0; });
+		}
+
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	void ThreadPool::workerLoop(size_t index) {
+		currentPool = this;
+		currentQueue = index;
+
+		std::function<void()> task;
+		while (true) {
+			if (popTask(index, task)) {
+				task();
+				task = nullptr;
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(_sleepMutex);
+			_wake.wait(lock, [this]() { return _stop || _pending > 0; });
+			if (_stop && _pending == 0)
+				return;
+		}
+	}
+
+	bool ThreadPool::popTask(size_t index, std::function<void()>& task) {
+		// own queue first, newest task
+		{
+			auto& queue = *_queues[index];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.tasks.empty()) {
+				task = std::move(queue.tasks.back());
+				queue.tasks.pop_back();
+				_pending--;
+				return true;
+			}
+		}
+		// then the oldest task submitted from outside, so those run in the order they came in
+		{
+			std::lock_guard<std::mutex> lock(_injected.mutex);
+			if (!_injected.tasks.empty()) {
+				task = std::move(_injected.tasks.front());
+				_injected.tasks.pop_front();
+				_pending--;
+				return true;
+			}
+		}
+		// then steal the oldest task of another queue
+		for (size_t i = 1; i < _queues.size(); i++) {
+			auto& queue = *_queues[(index + i) % _queues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.tasks.empty()) {
+				task = std::move(queue.tasks.front());
+				queue.tasks.pop_front();
+				_pending--;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool ThreadPool::runPendingTask() {
+		std::function<void()> task;
+		auto index = (currentPool == this) ? currentQueue : 0;
+		if (!popTask(index, task))
+			return false;
+		task();
+		return true;
+	}
+}
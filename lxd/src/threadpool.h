@@ -0,0 +1,59 @@
+#pragma once
+
+#include "defines.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lxd {
+	// Work-stealing pool: every worker owns a deque, pops its own tasks LIFO and steals FIFO
+	// from the others when it runs dry. Tasks submitted from outside the pool wait in a shared
+	// FIFO queue that workers check before stealing. Threads that wait on the pool help run tasks, so
+	// parallelFor may be nested inside a task.
+	class DLL_PUBLIC ThreadPool {
+	public:
+		explicit ThreadPool(size_t threadCount = std::thread::hardware_concurrency());
+		~ThreadPool();
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		size_t size() const { return _workers.size(); }
+		void submit(std::function<void()> task);
+		// runs func(i) for every i in [0, count) and returns once all calls finished,
+		// the first exception thrown by func is rethrown here
+		void parallelFor(size_t count, const std::function<void(size_t)>& func);
+
+		template <typename Func>
+		auto async(Func func) -> std::future<decltype(func())> {
+			auto task = std::make_shared<std::packaged_task<decltype(func())()>>(std::move(func));
+			auto result = task->get_future();
+			submit([task]() { (*task)(); });
+			return result;
+		}
+
+	private:
+		struct Queue {
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		void workerLoop(size_t index);
+		bool popTask(size_t index, std::function<void()>& task);
+		bool runPendingTask();
+
+	private:
+		std::vector<std::unique_ptr<Queue>> _queues;
+		Queue _injected;
+		std::vector<std::thread> _workers;
+		std::atomic<size_t> _pending{};
+		std::atomic<bool> _stop{};
+		std::mutex _sleepMutex;
+		std::condition_variable _wake;
+	};
+}
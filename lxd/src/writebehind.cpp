@@ -0,0 +1,95 @@
+#include "writebehind.h"
+#include "fileio.h"
+
+namespace lxd {
+	// written buffers kept for reuse, enough for double buffering a few files
+	static const size_t FreeBuffers = 8;
+
+	WriteBehind::WriteBehind(size_t byteBudget) : _byteBudget(byteBudget) {
+		_thread = std::thread(&WriteBehind::run, this);
+	}
+
+	WriteBehind::~WriteBehind() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_ready.notify_all();
+		_thread.join();
+	}
+
+	void WriteBehind::submit(void* handle, long long offset, std::vector<char> data) {
+		std::unique_lock<std::mutex> lock(_mutex);
+		// a single buffer larger than the budget still goes through once the queue is empty
+		auto fits = [&]() { return _queuedBytes == 0 || _queuedBytes + data.size() <= _byteBudget; };
+		if (!fits()) {
+			_stalls++;
+			_done.wait(lock, fits);
+		}
+
+		_queuedBytes += data.size();
+		_files[handle].pending++;
+		_jobs.push_back({ handle, offset, std::move(data) });
+		_ready.notify_one();
+	}
+
+	bool WriteBehind::sync(void* handle) {
+		std::unique_lock<std::mutex> lock(_mutex);
+		_done.wait(lock, [&]() {
+			auto it = _files.find(handle);
+			return it == _files.end() || it->second.pending == 0;
+		});
+
+		// forget the handle, the system may hand out its value again once it's closed
+		auto it = _files.find(handle);
+		if (it == _files.end())
+			return true;
+		bool ok = !it->second.failed;
+		_files.erase(it);
+		return ok;
+	}
+
+	void WriteBehind::sync() {
+		std::unique_lock<std::mutex> lock(_mutex);
+		_done.wait(lock, [this]() { return _queuedBytes == 0; });
+	}
+
+	std::vector<char> WriteBehind::acquire(size_t capacity) {
+		std::vector<char> buffer;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (!_free.empty()) {
+				buffer = std::move(_free.back());
+				_free.pop_back();
+			}
+		}
+		buffer.reserve(capacity);
+		return buffer;
+	}
+
+	void WriteBehind::run() {
+		std::unique_lock<std::mutex> lock(_mutex);
+		while (true) {
+			_ready.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+			// drain before stopping
+			if (_jobs.empty())
+				return;
+
+			auto job = std::move(_jobs.front());
+			_jobs.pop_front();
+			lock.unlock();
+			bool ok = WriteFileAt(job.handle, job.data.data(), job.data.size(), job.offset);
+			lock.lock();
+
+			_queuedBytes -= job.data.size();
+			auto& state = _files[job.handle];
+			state.pending--;
+			state.failed |= !ok;
+			if (_free.size() < FreeBuffers) {
+				job.data.clear();
+				_free.push_back(std::move(job.data));
+			}
+			_done.notify_all();
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "defines.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace lxd {
+	// A dedicated thread that writes buffers to files in the background, so the threads producing them
+	// go on with the next piece of work. Buffers are written in submission order; once more than the
+	// byte budget is queued, submit waits for the thread to catch up.
+	class DLL_PUBLIC WriteBehind {
+	public:
+		explicit WriteBehind(size_t byteBudget = 64 << 20);
+		~WriteBehind();
+		WriteBehind(const WriteBehind&) = delete;
+		WriteBehind& operator=(const WriteBehind&) = delete;
+
+		// queues data to be written to handle at offset
+		void submit(void* handle, long long offset, std::vector<char> data);
+		// waits until everything queued for handle is written, false if a write failed since the last sync
+		bool sync(void* handle);
+		// waits until the queue is empty
+		void sync();
+		// an empty buffer of at least capacity, recycled from the written ones when possible
+		std::vector<char> acquire(size_t capacity);
+
+		// the number of times submit had to wait for the budget
+		size_t stalls() const { return _stalls.load(); }
+
+	private:
+		struct Job {
+			void* handle;
+			long long offset;
+			std::vector<char> data;
+		};
+
+		struct FileState {
+			size_t pending{};
+			bool failed{};
+		};
+
+		void run();
+
+	private:
+		size_t _byteBudget;
+		size_t _queuedBytes{};
+		std::atomic<size_t> _stalls{};
+		bool _stop{};
+		std::deque<Job> _jobs;
+		std::unordered_map<void*, FileState> _files;
+		std::vector<std::vector<char>> _free;
+		std::mutex _mutex;
+		std::condition_variable _ready;
+		std::condition_variable _done;
+		std::thread _thread;
+	};
+}
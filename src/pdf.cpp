@@ -1,5 +1,7 @@
 // STL
 #include <map>
+#include <set>
+#include <list>
 #include <string>
 #include <vector>
 #include <memory>
@@ -10,6 +12,22 @@
 #include <codecvt>
 #include <cassert>
 #include <filesystem>
+#include <atomic>
+#include <limits>
+#include <algorithm>
+#include <memory_resource>
+#include <span>
+#include <array>
+#include <optional>
+#include <charconv>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <stop_token>
+#include <utility>
+#include <shared_mutex>
+#include <unordered_map>
+#include <cmath>
 // fmt format
 #include <fmt/format.h>
 #include <fmt/xchar.h>
@@ -17,11 +35,21 @@
 #include "../lxd/src/fileio.h"
 #include "../lxd/src/encoding.h"
 #include "../lxd/src/str.h"
-// windows api
-#include <Windows.h>
+#include "../lxd/src/localsocket.h"
+#include "../lxd/src/process.h"
+#include "../lxd/src/spscring.h"
+#include "../lxd/src/threadpool.h"
+#include "../lxd/src/writebehind.h"
 #include <cstring>
+#ifdef _WIN32
+// windows api, without the min/max macros that break std::min/std::max
+#define NOMINMAX
+#include <Windows.h>
 #include <atlstr.h>
 #include <wingdi.h>
+#else
+#include <unistd.h>
+#endif
 // stb 
 #define STB_IMAGE_IMPLEMENTATION
 #include "../util/stb_image.h"
@@ -36,13 +64,19 @@
 #undef LoadImage
 #endif
 
-#define DELETE_TXT_FILE
+// fmt only writes into std::string with the default allocator in place, let the arena backed
+// page buffers take the same path instead of a push_back per character
+template <>
+struct fmt::is_contiguous<std::pmr::string> : std::true_type {};
 
 namespace pdf {
 	using namespace std;
 	// Concepts Constraints
 	template<typename T>
-	concept hasContent = requires(T t) { t.Content(); };
+	concept hasContent = requires(T t) { t.GetContent(); };
+
+	template <typename T>
+	class Component;
 
 	template <typename T>
 	concept component = std::is_base_of<Component<T>, T>::value;
@@ -55,6 +89,32 @@ namespace pdf {
 		std::cout << std::endl;
 	}
 
+	// The work-stealing pool shared by every document, sized to the machine
+	lxd::ThreadPool& GetThreadPool() {
+		static lxd::ThreadPool pool;
+		return pool;
+	}
+
+	// The threads that wait for renderer processes. A renderer does its work in a process of its own and
+	// the thread only sleeps in the wait, so the waits are kept off the pool layout runs on. Twice the
+	// cores, so the shards of one document and a few documents in flight don't queue behind each other
+	lxd::ThreadPool& GetRenderPool() {
+		static lxd::ThreadPool pool(2 * GetThreadPool().size());
+		return pool;
+	}
+
+	// The I/O thread every page file is written on, so layout of the next page doesn't wait for the disk
+	lxd::WriteBehind& GetWriteBehind() {
+		static lxd::WriteBehind writer;
+		return writer;
+	}
+
+	// Runs func(i) for every i in [0, count) concurrently, may be nested
+	template <class Func>
+	void ParallelFor(size_t count, Func&& func) {
+		GetThreadPool().parallelFor(count, func);
+	}
+
 #define FLOAT_EQUAL(f0, f1) (abs((f1) - (f0)) < 0.0001)
 
 	enum class LANGUAGE {
@@ -78,984 +138,3802 @@ namespace pdf {
 	typedef Vector2 Position;
 	typedef Vector3 Color3;
 
-	enum class ALIGNMENT {
-		DEFAULT,
-		LEFT,
-		CENTER,
-		RIGHT,
-	};
+	// axis aligned box in depth coordinates (y grows downwards from the top of the page)
+	struct BoundingBox {
+		Vector2 position = {};
+		Vector2 size = {};
 
-	enum class FIGURE {
-		DEFAULT,
-		TEXT,
-		RECT,
-		LINE,
-		IMAGE
-	};
+		float Left() const { return position.x; }
+		float Right() const { return position.x + size.x; }
+		float Top() const { return position.y; }
+		float Bottom() const { return position.y + size.y; }
 
-	enum class TOOTH_IMAGE {
-		NORMAL,
-		ATTACHMENT,
-		MISSING
-	};
+		BoundingBox Translated(Vector2 offset) const {
+			return { { position.x + offset.x, position.y + offset.y }, size };
+		}
 
-	// PDF Canvas Size
-	const size_t PDF_WIDTH = 707;
-	const size_t PDF_HEIGHT = 1000;
-	const size_t PDF_BOTTOM = 900;
+		BoundingBox United(const BoundingBox& other) const {
+			auto left = std::min(Left(), other.Left()), top = std::min(Top(), other.Top());
+			return { { left, top }, { std::max(Right(), other.Right()) - left, std::max(Bottom(), other.Bottom()) - top } };
+		}
 
-	// Padding 
-	const size_t PDF_PADDING = 50;
-	const size_t PDF_LINE_PADDING = 8;
-	const size_t PDF_SECTION_PADDING = 20;
-	
-	struct TextStyle {
-		bool bold = false;
-		bool itallic = false;
-		bool underline = false;
-		ALIGNMENT alignment = ALIGNMENT::DEFAULT;
-		Vector2 alignmentRange = { 0.0 + PDF_PADDING,  PDF_WIDTH - PDF_PADDING };
-	};
+		bool Intersects(const BoundingBox& other) const {
+			return Left() <= other.Right() && other.Left() <= Right() && Top() <= other.Bottom() && other.Top() <= Bottom();
+		}
 
-	struct AttachmentInfo {
-		AttachmentInfo(int32_t fdi, const std::string& attName, int32_t startStep, int32_t endStep)
-			: fdi(fdi), attName(attName), startStep(startStep), endStep(endStep) {}
+		BoundingBox Inflated(float margin) const {
+			return { { position.x - margin, position.y - margin }, { size.x + 2 * margin, size.y + 2 * margin } };
+		}
 
-		int32_t fdi = {};
-		int32_t startStep = {}, endStep = {};
-		std::string attName;
-	};
+		// the overlap, empty when there is none
+		BoundingBox Intersected(const BoundingBox& other) const {
+			auto left = std::max(Left(), other.Left()), top = std::max(Top(), other.Top());
+			return { { left, top }, { std::max(std::min(Right(), other.Right()) - left, 0.0f), std::max(std::min(Bottom(), other.Bottom()) - top, 0.0f) } };
+		}
 
-	struct ImageInfo {
-		std::string m_imageId;
-		Vector2 horzRange = {};
-		Vector2 drawPosition = {};
-		int32_t width = {}, height = {};
-		float scaling = 1.0;
+		bool Empty() const { return size.x <= 0 || size.y <= 0; }
 	};
 
-	std::string UnicodeToUtf8(const std::wstring_view wstr) {
-#ifdef USE_LXD
-		return lxd::utf8_encode(wstr);
-#else 
-		std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
-		return converter.to_bytes(std::wstring(wstr));
-#endif
-	}
+	// Default number of decimals of content stream operands, a thousandth of a point or of a color channel
+	const int PDF_OPERAND_PRECISION = 3;
 
-	std::wstring Utf8ToUnicode(const std::string_view str) {
-#ifdef USE_LXD
-		return lxd::utf8_decode(str);
-#else 
-		std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
-		return converter.from_bytes(std::string(str));
-#endif
+	constexpr auto MakeDigitPairs() {
+		std::array<char, 200> pairs = {};
+		for (int i = 0; i < 100; i++) {
+			pairs[2 * i] = static_cast<char>('0' + i / 10);
+			pairs[2 * i + 1] = static_cast<char>('0' + i % 10);
+		}
+		return pairs;
 	}
 
-	static std::map<char, float> CharWidthPool;
+	inline constexpr auto DIGIT_PAIRS = MakeDigitPairs();
 
-	void InitCharWidthPool() {
-		for (char ch = (char)33; ch < (char)126; ch++) {
-			auto hdc = GetDC(NULL);
-			LPCSTR lpcCh(&ch);
-			SIZE sz;
-			GetTextExtentPoint32(hdc, lpcCh, 1, &sz);
-			auto magicNumber = 1.05;
-			CharWidthPool[ch] = sz.cx;
+	// writes the last `width` digits of value so they end at end, two at a time
+	inline void WriteDigits(char* end, uint64_t value, int width) {
+		for (; width >= 2; width -= 2) {
+			end -= 2;
+			std::memcpy(end, &DIGIT_PAIRS[2 * (value % 100)], 2);
+			value /= 100;
+		}
+		if (width) {
+			*--end = static_cast<char>('0' + value % 10);
 		}
 	}
 
-	LANGUAGE GetLanguage(uint32_t unicode) {
-		auto inRange = [](uint32_t uc, uint32_t rBeg, uint32_t rEnd) {
-			if (rBeg > rEnd) std::swap(rBeg, rEnd);
-			return uc >= rBeg && uc <= rEnd;
-		};
+	inline int CountDigits(uint64_t value) {
+		int digits = 1;
+		for (; value >= 100; value /= 100) digits += 2;
+		return digits + (value >= 10);
+	}
 
-		// Basic Chinese Unicode Range
-		if (inRange(unicode, 0x4E00, 0x9FA5) ||
-			inRange(unicode, 0xFF01, 0xFF1B) ||
-			inRange(unicode, 0x3001, 0x300F) ||
-			inRange(unicode, 0x2018, 0x201D)) {
-			return LANGUAGE::CHINESE;
-		}
-		else if ((unicode == '\n') || (unicode == '\r') || (unicode == '\t')) {
-			return LANGUAGE::ESCAPE_CHAR;
+	// the smallest printed unit for 0 - 6 decimals
+	inline constexpr uint32_t DECIMAL_SCALES[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+	// Writes a number already rounded to whole units of 10^-precision (0 - 6), without trailing zeros
+	inline char* FormatUnits(char* p, int64_t units, int precision) {
+		if (units == 0) {
+			*p++ = '0';
+			return p;
 		}
-		else if (unicode == ' ') {
-			return LANGUAGE::SPACING;
+		if (units < 0) {
+			*p++ = '-';
 		}
-		else {
-			return LANGUAGE::ENGLISH;
+
+		const auto scale = DECIMAL_SCALES[precision];
+		auto magnitude = static_cast<uint64_t>(units < 0 ? -units : units);
+		auto integer = magnitude / scale, fraction = magnitude % scale;
+		auto digits = CountDigits(integer);
+		WriteDigits(p + digits, integer, digits);
+		p += digits;
+
+		if (fraction) {
+			digits = precision;
+			while (fraction % 10 == 0) {
+				fraction /= 10;
+				digits--;
+			}
+			*p++ = '.';
+			WriteDigits(p + digits, fraction, digits);
+			p += digits;
 		}
+		return p;
 	}
 
-	template<class T>
-	class Component {
-	public:
-		Component() {
-			++m_componentCount;
+	// Writes a content stream number with at most precision (0 - 6) decimals and without trailing zeros,
+	// returns the end. fmt's shortest round trip spells the float 0.815 as 0.815000057220459 and is
+	// three times slower. buffer needs room for 32 chars. The result is always a valid pdf number: nan
+	// and inf are written as 0 and the absurdly large are clamped to 15 digits
+	inline char* FormatNumber(char* buffer, float value, int precision) {
+		precision = std::clamp(precision, 0, 6);
+		if (!std::isfinite(value)) {
+			assert(!"non-finite number in a content stream");
+			*buffer = '0';
+			return buffer + 1;
 		}
 
-		Component(Vector2 startPosition, Vector2 size = { 0.0, 0.0 })
-			: m_startPosition(startPosition), m_size(size)
-		{
-			++m_componentCount;
+		// round once, to a whole number of the smallest printed unit
+		auto scaled = std::abs(static_cast<double>(value)) * DECIMAL_SCALES[precision] + 0.5;
+		auto units = static_cast<int64_t>(std::min(scaled, 999999999999999.0));
+		return FormatUnits(buffer, value < 0 ? -units : units, precision);
+	}
+
+	enum class Font : uint8_t {
+		TmRm,
+		TmBd,
+		Song,
+		SnBd
+	};
+
+	const char* GetFontName(Font font) {
+		switch (font) {
+		case Font::TmRm: return "TmRm";
+		case Font::TmBd: return "TmBd";
+		case Font::Song: return "Song";
+		case Font::SnBd: return "SnBd";
 		}
+		return "TmRm";
+	}
 
-		Vector2 Size() const { return static_cast<T*>(this)->Size(); }
+	enum class Paint : uint8_t {
+		Fill,
+		Stroke
+	};
 
-		int32_t Count() const { return static_cast<T*>(this)->Count(); }
+	// what a BatchCommand draws for every row of its columns
+	enum class Shape : uint8_t {
+		Rect,
+		Line,
+		Circle
+	};
 
-		std::vector<std::string> GetContent() const { return static_cast<T*>(this)->GetContent(); }
+	// which areas a filled path covers, f or f*
+	enum class FillRule : uint8_t {
+		NonZero,
+		EvenOdd
+	};
 
-		Vector2 StartPosition() const { return static_cast<T*>(this)->StartPosition(); }
+	struct PathSegment {
+		enum class Type : uint8_t {
+			Move,
+			Line,
+			Curve,
+			Rect,
+			Close
+		};
 
-	public:
-		template<component U>
-		T& Append(U component) { static_cast<U*>(this)->Append(component); return static_cast<T&>(*this); }
+		Type type;
+		// Move and Line use the first point, Curve uses all three, Rect its bottom-left corner and size
+		Vector2 points[3];
+	};
 
-	protected:
-		inline static int32_t m_componentCount = {};
+// the circle of radius 1 around the origin as four bezier quarters, placed on the page by a cm
+#define PDF_UNIT_CIRCLE "-1 0 m -1 0.553 -0.553 1 0 1 c 0.553 1 1 0.553 1 0 c 1 -0.553 0.553 -1 0 -1 c -0.553 -1 -1 -0.553 -1 0 c h"
 
-		Vector2 m_size;
-		Vector2 m_startPosition;
+	// Display list commands, in pdf user space. Strings and path segments are stored in the pools of
+	// the owning DisplayList and referenced by offset, so the commands stay trivially copyable.
+	struct TextRunCommand {
+		Font font;
+		// <hex> string instead of a (literal) one
+		bool hex;
+		float fontSize;
+		Vector2 position;
+		float charSpacing;
+		uint32_t offset, length;
+	};
 
-		std::string m_content;
+	struct RectCommand {
+		Paint paint;
+		float lineWidth;
+		Color3 color;
+		// bottom-left corner
+		Vector2 position;
+		Vector2 size;
 	};
 
-	class Character {
-	public:
-		// regular i
-		Character(const wchar_t character, LANGUAGE lang, float fontSize, float charItvlRatio, bool bold)
-			: lang(lang), fontSize(fontSize), charItvlRatio(charItvlRatio), bold(bold)
-		{
-			auto interval = (charItvlRatio > 1.0) ? (charItvlRatio - 1.0) * fontSize : 0.0;
+	struct LineCommand {
+		float lineWidth;
+		Color3 color;
+		Vector2 from, to;
+	};
 
-			// font size calculation
-			if (lang == LANGUAGE::CHINESE) {
-				this->charLen = fontSize;
-				this->length = fontSize + interval;
+	struct PathCommand {
+		Paint paint;
+		FillRule rule;
+		float lineWidth;
+		Color3 color;
+		uint32_t first, count;
+	};
 
-				this->content = fmt::format("{:x}", (size_t)character);
-			}
-			else if (lang == LANGUAGE::ENGLISH) {
-				auto magicNumber = 1.05;
-				this->charLen = CharWidthPool[(char)character] * (fontSize / 16.0) * magicNumber;
-				this->length = this->charLen + interval;
+	// the shared unit circle scaled to radius and moved to center
+	struct CircleCommand {
+		Paint paint;
+		float lineWidth;
+		Color3 color;
+		Vector2 center;
+		float radius;
+	};
 
-				this->content = (char)character;
-			}
-			else if (lang == LANGUAGE::ESCAPE_CHAR) {
-				if (character == L'\t') {
-					this->fontSize = 0.0;
-					this->charLen = this->length = 2.0 * fontSize;
-				}
-				else {
-					this->charLen = this->length = this->fontSize = 0.0;
-				}
-				this->content = (char)character;
-			}
-			else if (lang == LANGUAGE::SPACING) {
-				this->length = this->charLen = 0.3 * fontSize;
-			}
-		}
+	// Many shapes of one style as columns in the float pool, count floats each starting at first:
+	// Rect x, y (bottom-left), width, height; Line x0, y0, x1, y1; Circle x, y (center), radius and
+	// the line width in the scaled space of every circle
+	struct BatchCommand {
+		Shape shape;
+		Paint paint;
+		float lineWidth;
+		Color3 color;
+		uint32_t first, count;
+	};
 
-		// Spacing constructor
-		Character(LANGUAGE lang, float spacing) : lang(lang) {
-			this->length = this->charLen = spacing;
-		}
+	struct ImageCommand {
+		// bottom-left corner
+		Vector2 position;
+		Vector2 size;
+		uint32_t offset, length;
+	};
 
-	public:
-		// character language
-		LANGUAGE lang;
-		// bare character length
-		float charLen;
-		// total length of a single character: including the character intervals
-		float length;
-		// character fontSize(not the same as charLen)
-		float fontSize;
-		// the interval between characters
-		float charItvlRatio;
-		// characters absolute position on pdf canvas
+	// saves the graphics state and translates, balanced by a RestoreCommand
+	struct TranslateCommand {
+		Vector2 translation;
+	};
+
+	// saves the graphics state and narrows the clip to a rect, balanced by a RestoreCommand
+	struct ClipCommand {
+		// bottom-left corner
 		Vector2 position;
-		// the character style
-		bool bold = false;
-		// the final content output to txt file 
-		std::variant<char, std::string> content;
+		Vector2 size;
 	};
 
-	class Text : Component<Text> {
+	struct RestoreCommand {};
+
+	// script text passed through as is, e.g. resource directives
+	struct RawCommand {
+		uint32_t offset, length;
+	};
+
+	// Recorded draw calls of one page (or of one component before it's placed on a page)
+	class DisplayList {
 	public:
-		Text() : m_fontSize(12.0), m_range(Vector2{ PDF_PADDING, PDF_WIDTH - PDF_PADDING }), m_charItvlRatio(1.0), m_lineItvl(1.2) {}
+		using Command = std::variant<TextRunCommand, RectCommand, LineCommand, PathCommand, CircleCommand, BatchCommand, ImageCommand, TranslateCommand, ClipCommand, RestoreCommand, RawCommand>;
 
-		Text(const std::wstring_view text, float fontSize, float charNumIndent = 0.0, bool bold = false)
-			: m_vanillaText(text), m_fontSize(fontSize),
-			m_range(Vector2{ PDF_PADDING, PDF_WIDTH - PDF_PADDING }),
-			m_charItvlRatio(1.0), m_lineItvl(1.2)
-		{
-			float indent = charNumIndent * m_fontSize;
-			m_text.emplace_back(LANGUAGE::SPACING, indent);
+	public:
+		DisplayList() : DisplayList(std::pmr::get_default_resource()) {}
 
-			for (const auto& ch : m_vanillaText) {
-				auto lang = GetLanguage(ch);
-				m_text.emplace_back(ch, lang, m_fontSize, m_charItvlRatio, bold);
-			}
+		explicit DisplayList(std::pmr::memory_resource* resource)
+			: m_commands(resource), m_segments(resource), m_floats(resource), m_bytes(resource) {}
+
+	public:
+		void RecordText(Font font, float fontSize, Vector2 position, float charSpacing, std::string_view text, bool hex) {
+			auto offset = Store(text);
+			m_commands.emplace_back(TextRunCommand{ font, hex, fontSize, position, charSpacing, offset, static_cast<uint32_t>(text.size()) });
 		}
 
-		Text(const std::wstring_view text, float fontSize, Vector2 pos, bool bold = false)
-			: Component(pos), m_vanillaText(text), m_fontSize(fontSize),
-			m_range(Vector2{ PDF_PADDING, PDF_WIDTH - PDF_PADDING }), m_charItvlRatio(1.0), m_lineItvl(1.2)
-		{
-			m_startPosition.y = PDF_HEIGHT - pos.y;
+		void RecordRect(Paint paint, float lineWidth, Color3 color, Vector2 position, Vector2 size) {
+			m_commands.emplace_back(RectCommand{ paint, lineWidth, color, position, size });
+		}
 
-			for (const auto& ch : m_vanillaText) {
-				auto lang = GetLanguage(ch);
-				m_text.emplace_back(ch, lang, m_fontSize, m_charItvlRatio, bold);
-			}
+		void RecordLine(float lineWidth, Color3 color, Vector2 from, Vector2 to) {
+			m_commands.emplace_back(LineCommand{ lineWidth, color, from, to });
 		}
 
-		Text(const std::wstring_view text, float fontSize, float depth, ALIGNMENT alignment, bool bold = false)
-			: Component({ 0, depth }), m_vanillaText(text), m_fontSize(fontSize),
-			m_range(Vector2{ PDF_PADDING, PDF_WIDTH - PDF_PADDING }), m_charItvlRatio(1.0), m_lineItvl(1.2), m_alignment(alignment)
-		{
-			m_startPosition.y = PDF_HEIGHT - depth;
+		void RecordPath(Paint paint, float lineWidth, Color3 color, std::span<const PathSegment> segments, FillRule rule = FillRule::NonZero) {
+			auto first = static_cast<uint32_t>(m_segments.size());
+			m_segments.insert(m_segments.end(), segments.begin(), segments.end());
+			m_commands.emplace_back(PathCommand{ paint, rule, lineWidth, color, first, static_cast<uint32_t>(segments.size()) });
+		}
 
-			for (const auto& ch : m_vanillaText) {
-				auto lang = GetLanguage(ch);
-				m_text.emplace_back(ch, lang, m_fontSize, m_charItvlRatio, bold);
-			}
+		void RecordCircle(Paint paint, float lineWidth, Color3 color, Vector2 center, float radius) {
+			m_commands.emplace_back(CircleCommand{ paint, lineWidth, color, center, radius });
 		}
 
-	public:
-		void CalcLayout() {
-			static bool run_once = true;
-
-			auto& t = m_text;
-			auto textHandling = [&]() {
-				Vector2 curPos = { m_range.x, m_startPosition.y };
-				int i = 0;
-				for (auto& ch : m_text) {
-					bool lineOverflow = static_cast<int>(curPos.x + ch.charLen) > m_range.y;
-					bool EOL = (ch.lang == LANGUAGE::ESCAPE_CHAR) && (std::get<char>(ch.content) == '\n');
-
-					if (lineOverflow || EOL) {
-						// std::cout << "line overflow: " << curPos.x << '\t' << i << std::endl;
-						m_lineCount++;
-						curPos.y -= m_fontSize * m_lineItvl;
-						curPos.x = m_range.x;
+		// the batch records take columns of equal length and become a single command
+		void RecordRects(Paint paint, float lineWidth, Color3 color, std::span<const float> x, std::span<const float> y, std::span<const float> width, std::span<const float> height) {
+			RecordBatch(Shape::Rect, paint, lineWidth, color, { x, y, width, height });
+		}
 
-						if (m_autoNextPage && (curPos.y < PDF_PADDING)) {
-							curPos.x = m_range.x;
-							curPos.y = PDF_HEIGHT - PDF_PADDING;
-						}
-					}
+		void RecordLines(float lineWidth, Color3 color, std::span<const float> x0, std::span<const float> y0, std::span<const float> x1, std::span<const float> y1) {
+			RecordBatch(Shape::Line, Paint::Stroke, lineWidth, color, { x0, y0, x1, y1 });
+		}
 
-					ch.position = curPos;
-					curPos.x += ch.length;
-					i++;
-					// if (run_once) std::cout << "curPos.x: " << curPos.x << std::endl;
-				}
-			};
+		void RecordCircles(Paint paint, float lineWidth, Color3 color, std::span<const float> x, std::span<const float> y, std::span<const float> radius) {
+			RecordBatch(Shape::Circle, paint, lineWidth, color, { x, y, radius });
+			for (auto r : radius)
+				m_floats.push_back(r > 0 ? lineWidth / r : 0.0f);
+		}
 
-			m_lineCount = 0;
-			switch (m_alignment) {
-			case ALIGNMENT::DEFAULT: {
-				m_range = Vector2{ m_startPosition.x, PDF_WIDTH - PDF_PADDING };
-				textHandling();
-				break;
-			}
-			case ALIGNMENT::LEFT: {
-				m_range = Vector2{ PDF_PADDING, PDF_WIDTH - PDF_PADDING };
-				textHandling();
-				break;
-			}
-			case ALIGNMENT::CENTER: {
-				auto textLength = GetLength();
-				auto itvlCompensation = (m_text.back().length - m_text.back().charLen) / 2.0;
-				float offset = (m_range.x + m_range.y) / 2.0 - textLength / 2.0 + itvlCompensation;
-				m_range = Vector2{ offset, PDF_WIDTH - PDF_PADDING };
-				textHandling();
-				break;
-			}
-			case ALIGNMENT::RIGHT: {
-				auto textLength = GetLength();
-				auto itvlCompensation = m_text.back().length - m_text.back().charLen;
-				auto offset = m_range.y - textLength + itvlCompensation;
-				m_range.x = offset;
-				textHandling();
-				break;
-			}
-			}
-			run_once = false;
+		void RecordImage(std::string_view imageId, Vector2 position, Vector2 size) {
+			auto offset = Store(imageId);
+			m_commands.emplace_back(ImageCommand{ position, size, offset, static_cast<uint32_t>(imageId.size()) });
 		}
 
-		std::vector<std::string> GetContent() const {
-			if (!m_text.size()) return std::vector<std::string>{};
+		void PushTranslation(Vector2 translation) {
+			m_commands.emplace_back(TranslateCommand{ translation });
+		}
 
-			std::vector<std::string> textVec;
-			textVec.emplace_back();
-			auto ret = &textVec[0];
-
-			// state control vars
-			auto preLang = m_text[0].lang;
-			auto prePos = m_text[0].position;
-			auto preBold = m_text[0].bold;
-			auto xInc = m_range.x;
-			std::string buffer;
+		void PushClip(Vector2 position, Vector2 size) {
+			m_commands.emplace_back(ClipCommand{ position, size });
+		}
 
-			// lambda handle func
-			auto hanndleSpecialChar = [&buffer]() {
-				auto pos = buffer.find('(');
+		void Pop() {
+			m_commands.emplace_back(RestoreCommand{});
+		}
 
-				if (pos != std::string::npos) {
-					buffer.insert(pos, "\\");
-				}
+		void RecordRaw(std::string_view script) {
+			auto offset = Store(script);
+			m_commands.emplace_back(RawCommand{ offset, static_cast<uint32_t>(script.size()) });
+		}
 
-				pos = buffer.find(')');
+		void Append(const DisplayList& other) {
+			auto byteBase = static_cast<uint32_t>(m_bytes.size());
+			auto segmentBase = static_cast<uint32_t>(m_segments.size());
+			auto floatBase = static_cast<uint32_t>(m_floats.size());
+			m_bytes.append(other.m_bytes);
+			m_segments.insert(m_segments.end(), other.m_segments.begin(), other.m_segments.end());
+			m_floats.insert(m_floats.end(), other.m_floats.begin(), other.m_floats.end());
+
+			m_commands.reserve(m_commands.size() + other.m_commands.size());
+			for (auto command : other.m_commands) {
+				std::visit([byteBase, segmentBase, floatBase](auto& c) {
+					using T = std::decay_t<decltype(c)>;
+					if constexpr (std::is_same_v<T, PathCommand>)
+						c.first += segmentBase;
+					else if constexpr (std::is_same_v<T, BatchCommand>)
+						c.first += floatBase;
+					else if constexpr (std::is_same_v<T, TextRunCommand> || std::is_same_v<T, ImageCommand> || std::is_same_v<T, RawCommand>)
+						c.offset += byteBase;
+				}, command);
+				m_commands.push_back(command);
+			}
+		}
 
-				if (pos != std::string::npos) {
-					buffer.insert(pos, "\\");
-				}
-			};
+		void Clear() {
+			m_commands.clear();
+			m_segments.clear();
+			m_floats.clear();
+			m_bytes.clear();
+		}
 
-			// дļlambda func
-			auto writeToFile = [&](int32_t i) {
-				// mutoolͻַת
-				hanndleSpecialChar();
+	public:
+		bool Empty() const { return m_commands.empty(); }
 
-				// spacing char
-				if (preLang == LANGUAGE::SPACING) {
-					preLang = m_text[i].lang;
-					prePos = m_text[i].position;
-					return;
-				}
+		const std::pmr::vector<Command>& Commands() const { return m_commands; }
 
-				auto writable = (preLang == LANGUAGE::CHINESE) || (preLang == LANGUAGE::ENGLISH);
+		std::string_view Bytes(uint32_t offset, uint32_t length) const { return std::string_view(m_bytes).substr(offset, length); }
 
-				auto font = (preLang == LANGUAGE::CHINESE) ? "Song" : "TmRm";
+		std::span<const PathSegment> Segments(uint32_t first, uint32_t count) const { return std::span(m_segments).subspan(first, count); }
 
-				std::string content;
-				if (preLang == LANGUAGE::CHINESE)
-					content = fmt::format("<{}>", buffer);
-				else if (preLang == LANGUAGE::ENGLISH)
-					content = fmt::format("({})", buffer);
+		std::span<const float> Floats(uint32_t first, uint32_t count) const { return std::span(m_floats).subspan(first, count); }
 
-				auto bufferFontSize = m_text[i - 1].fontSize;
-				auto charItvl = (m_charItvlRatio - 1.0) * bufferFontSize;
+	private:
+		uint32_t Store(std::string_view bytes) {
+			auto offset = static_cast<uint32_t>(m_bytes.size());
+			m_bytes.append(bytes);
+			return offset;
+		}
 
-				// draw content
-				if (writable) {
-					if (preBold) {
-						// ret->append(fmt::format("q\nBT /{} {} Tf 2 Tr 1 0 0 1 {} {} Tm {} {} {} \" ET\nQ\r\n",
-						// 	font, bufferFontSize, prePos.x, prePos.y, 0, charItvl, content));
-						auto offset = 0.2 * (bufferFontSize / 16.0);
-						ret->append(fmt::format("BT /{} {} Tf 1 0 0 1 {} {} Tm {} {} {} \" ET\r\n",
-							font, bufferFontSize, prePos.x, prePos.y, 0, charItvl, content));
-
-						ret->append(fmt::format("BT /{} {} Tf 1 0 0 1 {} {} Tm {} {} {} \" ET\r\n",
-							font, bufferFontSize, prePos.x + offset, prePos.y, 0, charItvl, content));
-						ret->append(fmt::format("BT /{} {} Tf 1 0 0 1 {} {} Tm {} {} {} \" ET\r\n",
-							font, bufferFontSize, prePos.x - offset, prePos.y, 0, charItvl, content));
-						ret->append(fmt::format("BT /{} {} Tf 1 0 0 1 {} {} Tm {} {} {} \" ET\r\n",
-							font, bufferFontSize, prePos.x, prePos.y + offset, 0, charItvl, content));
-						ret->append(fmt::format("BT /{} {} Tf 1 0 0 1 {} {} Tm {} {} {} \" ET\r\n",
-							font, bufferFontSize, prePos.x, prePos.y - offset, 0, charItvl, content));
-					}
-					else {
-						ret->append(fmt::format("BT /{} {} Tf 1 0 0 1 {} {} Tm {} {} {} \" ET\r\n",
-							font, bufferFontSize, prePos.x, prePos.y, 0, charItvl, content));
-					}
-				}
+		void RecordBatch(Shape shape, Paint paint, float lineWidth, Color3 color, std::initializer_list<std::span<const float>> columns) {
+			auto first = static_cast<uint32_t>(m_floats.size());
+			auto count = columns.begin()->size();
+			for (auto column : columns) {
+				assert(column.size() == count);
+				m_floats.insert(m_floats.end(), column.begin(), column.end());
+			}
+			m_commands.emplace_back(BatchCommand{ shape, paint, lineWidth, color, first, static_cast<uint32_t>(count) });
+		}
 
-				// state update
-				preBold = m_text[i].bold;
-				preLang = m_text[i].lang;
-				prePos = m_text[i].position;
+	private:
+		std::pmr::vector<Command> m_commands;
+		std::pmr::vector<PathSegment> m_segments;
+		std::pmr::vector<float> m_floats;
+		std::pmr::string m_bytes;
+	};
 
-				buffer.clear();
-			};
+	// What culling left out: components off the page that were never recorded, and the commands (glyph
+	// runs among them) the writer skipped because they miss the page or the clip
+	struct CullStats {
+		uint32_t components = 0;
+		uint32_t commands = 0;
+		uint32_t textRuns = 0;
+	};
 
-			// main process
-			for (int32_t i = 0; i < m_text.size(); i++) {
-				bool EOL = (m_text[i].lang == LANGUAGE::ESCAPE_CHAR) && (std::get<char>(m_text[i].content) == '\n');
-				bool overflow = static_cast<int>(xInc + m_text[i].charLen) > m_range.y;
+	// An operator sequence with {} placeholders, split into its literal pieces at compile time
+	template<size_t N>
+	struct OperatorTemplate {
+		char text[N] = {};
 
-				auto BufferAppend = [&]() {
-					if (m_text[i].lang == LANGUAGE::CHINESE)
-						buffer.append(std::get<std::string>(m_text[i].content));
-					else if (m_text[i].lang == LANGUAGE::ENGLISH)
-						buffer += std::get<char>(m_text[i].content);
-				};
+		constexpr OperatorTemplate(const char (&literal)[N]) {
+			std::copy_n(literal, N, text);
+		}
 
-				if (overflow || EOL) {
-					writeToFile(i);
+		constexpr size_t Arity() const {
+			size_t arity = 0;
+			for (size_t i = 0; i + 1 < N - 1; i++) {
+				if (text[i] == '{' && text[i + 1] == '}') {
+					arity++;
+					i++;
+				}
+			}
+			return arity;
+		}
 
-					if (m_autoNextPage && (m_text[i].position.y > m_text[i - 1].position.y)) {
-						textVec.emplace_back();
-						ret = &textVec.back();
-					}
+		// the literals around the placeholders, Arity() + 1 of them
+		template<size_t Arity>
+		constexpr std::array<std::string_view, Arity + 1> Pieces() const {
+			std::array<std::string_view, Arity + 1> pieces = {};
+			size_t begin = 0, piece = 0;
+			for (size_t i = 0; i + 1 < N - 1; i++) {
+				if (text[i] == '{' && text[i + 1] == '}') {
+					pieces[piece++] = std::string_view(text + begin, i - begin);
+					begin = i + 2;
+					i++;
+				}
+			}
+			pieces[piece] = std::string_view(text + begin, N - 1 - begin);
+			return pieces;
+		}
+	};
 
-					BufferAppend();
+	// Serializes display lists to the page script format read by mutool create. Every operator sequence
+	// is an OperatorTemplate, so the literals are known at compile time and only the operands are
+	// formatted at run time: numbers through FormatNumber with precision decimals, strings as is.
+	class ScriptWriter {
+	public:
+		ScriptWriter(const DisplayList& list, std::pmr::string& out, int precision = PDF_OPERAND_PRECISION)
+			: m_list(list), m_out(out), m_precision(std::clamp(precision, 0, 6)) {}
 
-					xInc = m_range.x;
-					xInc += m_text[i].length;
+		// culls against viewport, a box in pdf space whose position is the bottom-left corner
+		ScriptWriter(const DisplayList& list, std::pmr::string& out, int precision, const BoundingBox& viewport, CullStats& stats)
+			: ScriptWriter(list, out, precision)
+		{
+			m_stats = &stats;
+			m_states.push_back({ {}, viewport });
+		}
 
-					if (i == m_text.size() - 1)
-						writeToFile(i);
+		static void Write(const DisplayList& list, std::pmr::string& out, int precision = PDF_OPERAND_PRECISION) {
+			ScriptWriter writer(list, out, precision);
+			for (const auto& command : list.Commands()) {
+				std::visit(writer, command);
+			}
+		}
 
-					continue;
-				}
+		// leaves out every command that lies outside of viewport or of the clip in effect
+		static void Write(const DisplayList& list, std::pmr::string& out, int precision, const BoundingBox& viewport, CullStats& stats) {
+			ScriptWriter writer(list, out, precision, viewport, stats);
+			for (const auto& command : list.Commands()) {
+				if (writer.Visible(command))
+					std::visit(writer, command);
+			}
+		}
 
-				// text style differ
-				if (preBold != m_text[i].bold) {
-					writeToFile(i);
-				}
+	public:
+		void operator()(const TextRunCommand& command) {
+			const auto& p = command.position;
+			auto text = m_list.Bytes(command.offset, command.length);
+			if (command.hex)
+				Emit<"BT /{} {} Tf 1 0 0 1 {} {} Tm 0 {} <{}> \" ET\r\n">(GetFontName(command.font), command.fontSize, p.x, p.y, command.charSpacing, text);
+			else
+				Emit<"BT /{} {} Tf 1 0 0 1 {} {} Tm 0 {} ({}) \" ET\r\n">(GetFontName(command.font), command.fontSize, p.x, p.y, command.charSpacing, text);
+		}
 
-				// languages differ
-				if (preLang != m_text[i].lang) {
-					writeToFile(i);
-				}
+		void operator()(const RectCommand& command) {
+			const auto& c = command.color;
+			const auto& p = command.position;
+			const auto& s = command.size;
+			if (command.paint == Paint::Fill)
+				Emit<"% Draw a rect\r\nq {} {} {} rg {} {} {} {} re f Q\r\n">(c.x, c.y, c.z, p.x, p.y, s.x, s.y);
+			else
+				Emit<"% Draw a Outline rect\r\nq {} w {} {} {} RG {} {} {} {} re h s Q\r\n">(command.lineWidth, c.x, c.y, c.z, p.x, p.y, s.x, s.y);
+		}
 
-				// character appending
-				BufferAppend();
+		void operator()(const LineCommand& command) {
+			const auto& c = command.color;
+			Emit<"% Draw a line\r\nq {} {} {} RG {} {} m {} {} l {} w S Q\r\n">(c.x, c.y, c.z, command.from.x, command.from.y, command.to.x, command.to.y, command.lineWidth);
+		}
 
-				// β
-				if ((i == m_text.size() - 1) && !buffer.empty()) {
-					writeToFile(i);
+		void operator()(const PathCommand& command) {
+			const auto& c = command.color;
+			if (command.paint == Paint::Fill)
+				Emit<"% Draw a path\r\nq {} w {} {} {} rg\r\n">(command.lineWidth, c.x, c.y, c.z);
+			else
+				Emit<"% Draw a path\r\nq {} w {} {} {} RG\r\n">(command.lineWidth, c.x, c.y, c.z);
+
+			for (const auto& segment : m_list.Segments(command.first, command.count)) {
+				const auto& p = segment.points;
+				switch (segment.type) {
+				case PathSegment::Type::Move: Emit<"{} {} m\r\n">(p[0].x, p[0].y); break;
+				case PathSegment::Type::Line: Emit<"{} {} l\r\n">(p[0].x, p[0].y); break;
+				case PathSegment::Type::Curve: Emit<"{} {} {} {} {} {} c\r\n">(p[0].x, p[0].y, p[1].x, p[1].y, p[2].x, p[2].y); break;
+				case PathSegment::Type::Rect: Emit<"{} {} {} {} re\r\n">(p[0].x, p[0].y, p[1].x, p[1].y); break;
+				case PathSegment::Type::Close: Emit<"h\r\n">(); break;
 				}
-
-				xInc += m_text[i].length;
 			}
 
-			return textVec;
+			if (command.paint == Paint::Stroke)
+				Emit<"S Q\r\n">();
+			else if (command.rule == FillRule::EvenOdd)
+				Emit<"f* Q\r\n">();
+			else
+				Emit<"f Q\r\n">();
 		}
 
-	public:
-		float GetLength() {
-			float length{};
-			for (const auto& ch : m_text)
-				length += ch.length;
-			return length;
+		// one cm and a constant path instead of 26 formatted coordinates, the stroke width is given
+		// in the scaled space and so divided by the radius
+		void operator()(const CircleCommand& command) {
+			const auto& c = command.color;
+			const auto& p = command.center;
+			const auto r = command.radius;
+			if (command.paint == Paint::Fill)
+				Emit<"% Draw a circle\r\nq {} {} {} rg {} 0 0 {} {} {} cm " PDF_UNIT_CIRCLE " f Q\r\n">(c.x, c.y, c.z, r, r, p.x, p.y);
+			else
+				Emit<"% Draw a circle\r\nq {} {} {} RG {} 0 0 {} {} {} cm {} w " PDF_UNIT_CIRCLE " S Q\r\n">(c.x, c.y, c.z, r, r, p.x, p.y, r > 0 ? command.lineWidth / r : 0.0f);
 		}
 
-		float GetFontSize() const {
-			return m_fontSize;
+		// one graphics state for the whole batch, rects and lines become a single path
+		void operator()(const BatchCommand& command) {
+			if (command.count == 0)
+				return;
+
+			const auto& c = command.color;
+			switch (command.shape) {
+			case Shape::Rect: {
+				if (command.paint == Paint::Fill) {
+					Emit<"% Draw rects\r\nq {} {} {} rg\r\n">(c.x, c.y, c.z);
+					EmitRows<"{} {} {} {} re\r\n", 0, 1, 2, 3>(command);
+					Emit<"f Q\r\n">();
+				}
+				else {
+					Emit<"% Draw outline rects\r\nq {} w {} {} {} RG\r\n">(command.lineWidth, c.x, c.y, c.z);
+					EmitRows<"{} {} {} {} re\r\n", 0, 1, 2, 3>(command);
+					Emit<"S Q\r\n">();
+				}
+				break;
+			}
+			case Shape::Line: {
+				Emit<"% Draw lines\r\nq {} w {} {} {} RG\r\n">(command.lineWidth, c.x, c.y, c.z);
+				EmitRows<"{} {} m {} {} l\r\n", 0, 1, 2, 3>(command);
+				Emit<"S Q\r\n">();
+				break;
+			}
+			case Shape::Circle: {
+				if (command.paint == Paint::Fill) {
+					Emit<"% Draw circles\r\nq {} {} {} rg\r\n">(c.x, c.y, c.z);
+					EmitRows<"q {} 0 0 {} {} {} cm " PDF_UNIT_CIRCLE " f Q\r\n", 2, 2, 0, 1>(command);
+				}
+				else {
+					Emit<"% Draw circles\r\nq {} {} {} RG\r\n">(c.x, c.y, c.z);
+					EmitRows<"q {} 0 0 {} {} {} cm {} w " PDF_UNIT_CIRCLE " S Q\r\n", 2, 2, 0, 1, 3>(command);
+				}
+				Emit<"Q\r\n">();
+				break;
+			}
+			}
 		}
 
-		Vector2 GetLastCharPosition() const {
-			return m_text.back().position;
+		void operator()(const ImageCommand& command) {
+			const auto& p = command.position;
+			const auto& s = command.size;
+			Emit<"% Draw an image\r\nq {} 0 0 {} {} {} cm {} Do Q\r\n">(s.x, s.y, p.x, p.y, m_list.Bytes(command.offset, command.length));
 		}
 
-		float GetBottom() const {
-			if (!m_text.empty()) {
-				return m_text.back().position.y;
+		void operator()(const TranslateCommand& command) {
+			Emit<"q 1 0 0 1 {} {} cm\r\n">(command.translation.x, command.translation.y);
+			if (m_stats) {
+				auto state = m_states.back();
+				state.translation = { state.translation.x + command.translation.x, state.translation.y + command.translation.y };
+				m_states.push_back(state);
 			}
-			else {
-				return PDF_HEIGHT - PDF_PADDING;
+		}
+
+		void operator()(const ClipCommand& command) {
+			Emit<"q {} {} {} {} re W n\r\n">(command.position.x, command.position.y, command.size.x, command.size.y);
+			if (m_stats) {
+				auto state = m_states.back();
+				state.clip = state.clip.Intersected(BoundingBox{ command.position, command.size }.Translated(state.translation));
+				m_states.push_back(state);
 			}
 		}
 
-		bool Empty() const {
-			return (m_text.size() == 0);
+		void operator()(const RestoreCommand&) {
+			Emit<"Q\r\n">();
+			if (m_stats && m_states.size() > 1)
+				m_states.pop_back();
+		}
+
+		void operator()(const RawCommand& command) {
+			m_out.append(m_list.Bytes(command.offset, command.length));
 		}
 
 	public:
-		// Text manipulation
-		Text& Append(const std::wstring_view text, bool bold = false) {
-			for (const auto& ch : text) {
-				auto lang = GetLanguage(ch);
-				m_text.emplace_back(ch, lang, m_fontSize, m_charItvlRatio, bold);
-			}
-			return *this;
+		// Literals and numbers are collected in a stack buffer sized at compile time and appended once,
+		// a string operand flushes the buffer and is appended as is
+		template<OperatorTemplate Format, class... Args>
+		void Emit(const Args&... args) {
+			static_assert(Format.Arity() == sizeof...(Args), "operand count doesn't match the operator template");
+			static constexpr auto pieces = Format.template Pieces<sizeof...(Args)>();
+
+			char buffer[sizeof(Format.text) + 32 * sizeof...(Args)];
+			auto p = buffer;
+			[&]<size_t... I>(std::index_sequence<I...>) {
+				((p = Put(buffer, Put(buffer, p, pieces[I]), args)), ...);
+			}(std::index_sequence_for<Args...>{});
+			p = Put(buffer, p, pieces[sizeof...(Args)]);
+			m_out.append(buffer, p);
 		}
 
-		template<component U>
-		Text& Append(U component) {
-			m_content.append(component.GetContent().font());
-			return *this;
+		// Writes Format once per row of a batch, the placeholders taking the values of Columns. Blocks of rows
+		// are first rounded to whole units column by column, a loop without branches the compiler vectorizes,
+		// and then written with FormatUnits. A block with a value beyond 32 bits goes through Emit instead
+		template<OperatorTemplate Format, int... Columns>
+		void EmitRows(const BatchCommand& command) {
+			static_assert(Format.Arity() == sizeof...(Columns), "column count doesn't match the operator template");
+			static constexpr auto pieces = Format.template Pieces<sizeof...(Columns)>();
+			static constexpr size_t columnCount = std::max({ Columns... }) + 1;
+			static constexpr uint32_t blockSize = 64;
+
+			int32_t units[columnCount][blockSize];
+			char buffer[blockSize * (sizeof(Format.text) + 12 * sizeof...(Columns))];
+			const double scale = DECIMAL_SCALES[m_precision];
+			auto column = [&](size_t k, uint32_t begin, uint32_t count) {
+				return m_list.Floats(command.first + static_cast<uint32_t>(k) * command.count + begin, count);
+			};
+
+			for (uint32_t begin = 0; begin < command.count; begin += blockSize) {
+				auto count = std::min(blockSize, command.count - begin);
+				bool fits = true;
+				for (size_t k = 0; k < columnCount; k++)
+					fits &= ScaleColumn(column(k, begin, count), scale, units[k]);
+
+				if (!fits) {
+					for (uint32_t i = 0; i < count; i++)
+						Emit<Format>(column(Columns, begin, count)[i]...);
+					continue;
+				}
+
+				auto p = buffer;
+				for (uint32_t i = 0; i < count; i++) {
+					[&]<size_t... I>(std::index_sequence<I...>) {
+						((p = FormatUnits(std::copy(pieces[I].begin(), pieces[I].end(), p), units[Columns][i], m_precision)), ...);
+					}(std::index_sequence_for<decltype(Columns)...>{});
+					p = std::copy(pieces[sizeof...(Columns)].begin(), pieces[sizeof...(Columns)].end(), p);
+				}
+				m_out.append(buffer, p);
+			}
 		}
 
-		Text& SetFontSize(float fontSize) {
-			m_fontSize = fontSize;
-			for (auto& ch : m_text) {
-				ch.fontSize = fontSize;
+	private:
+		// Boxes of the drawing commands in pdf space (position at the bottom-left), strokes included.
+		// Text runs are bounded generously, every glyph an em wide and the run two ems high
+		struct Extent {
+			float left = std::numeric_limits<float>::max(), bottom = std::numeric_limits<float>::max();
+			float right = std::numeric_limits<float>::lowest(), top = std::numeric_limits<float>::lowest();
+
+			void Add(float x, float y) {
+				left = std::min(left, x);
+				right = std::max(right, x);
+				bottom = std::min(bottom, y);
+				top = std::max(top, y);
 			}
-			return *this;
+
+			BoundingBox Box(float margin) const {
+				return BoundingBox{ { left, bottom }, { right - left, top - bottom } }.Inflated(margin);
+			}
+		};
+
+		static float StrokeMargin(Paint paint, float lineWidth) {
+			return (paint == Paint::Stroke) ? lineWidth / 2 : 0.0f;
 		}
 
-		Text& Space(float spacing = 0.0) {
-			m_text.emplace_back(LANGUAGE::SPACING, spacing);
-			return *this;
+		std::optional<BoundingBox> Bounds(const TextRunCommand& command) const {
+			// hex strings spend at least two digits on a glyph
+			auto glyphs = command.hex ? (command.length + 1) / 2 : command.length;
+			auto advance = command.fontSize + std::max(command.charSpacing, 0.0f);
+			return BoundingBox{ { command.position.x, command.position.y - command.fontSize }, { glyphs * advance, 2 * command.fontSize } };
 		}
 
-		Text& SetIndent(float charNum) {
-			auto indentLen = charNum * m_fontSize;
-			m_text.emplace_back(LANGUAGE::SPACING, indentLen);
-			return *this;
+		std::optional<BoundingBox> Bounds(const RectCommand& command) const {
+			Extent extent;
+			extent.Add(command.position.x, command.position.y);
+			extent.Add(command.position.x + command.size.x, command.position.y + command.size.y);
+			return extent.Box(StrokeMargin(command.paint, command.lineWidth));
 		}
 
-		Text& NextLine() {
-			m_text.emplace_back(L'\n', LANGUAGE::ESCAPE_CHAR, 0.0, 0.0, false);
-			return *this;
+		std::optional<BoundingBox> Bounds(const LineCommand& command) const {
+			Extent extent;
+			extent.Add(command.from.x, command.from.y);
+			extent.Add(command.to.x, command.to.y);
+			return extent.Box(command.lineWidth / 2);
 		}
 
-		Text& SetAutoNextPage(bool flag) {
-			m_autoNextPage = flag;
-			return *this;
+		std::optional<BoundingBox> Bounds(const PathCommand& command) const {
+			Extent extent;
+			for (const auto& segment : m_list.Segments(command.first, command.count)) {
+				const auto& p = segment.points;
+				switch (segment.type) {
+				case PathSegment::Type::Move:
+				case PathSegment::Type::Line: extent.Add(p[0].x, p[0].y); break;
+				case PathSegment::Type::Curve: for (const auto& point : p) extent.Add(point.x, point.y); break;
+				case PathSegment::Type::Rect: extent.Add(p[0].x, p[0].y); extent.Add(p[0].x + p[1].x, p[0].y + p[1].y); break;
+				case PathSegment::Type::Close: break;
+				}
+			}
+			return extent.Box(StrokeMargin(command.paint, command.lineWidth));
 		}
 
-		Text& SetDepth(float depth) {
-			m_startPosition.y = PDF_HEIGHT - depth;
-			return *this;
+		std::optional<BoundingBox> Bounds(const CircleCommand& command) const {
+			const auto& c = command.center;
+			const auto r = std::abs(command.radius);
+			return BoundingBox{ { c.x - r, c.y - r }, { 2 * r, 2 * r } }.Inflated(StrokeMargin(command.paint, command.lineWidth));
 		}
 
-		Text& SetPosition(Vector2 position) {
-			m_startPosition = position;
-			auto depth = FLOAT_EQUAL(m_startPosition.y, 0.0) ? PDF_PADDING : m_startPosition.y;
-			m_startPosition.y = PDF_HEIGHT - depth;
-			return *this;
+		std::optional<BoundingBox> Bounds(const BatchCommand& command) const {
+			if (command.count == 0)
+				return std::nullopt;
+
+			auto column = [&](uint32_t k) { return m_list.Floats(command.first + k * command.count, command.count); };
+			auto x = column(0), y = column(1), z = column(2);
+			Extent extent;
+			switch (command.shape) {
+			case Shape::Rect:
+			case Shape::Line: {
+				// the far corner of a rect, the end of a line
+				auto w = column(3);
+				for (uint32_t i = 0; i < command.count; i++) {
+					extent.Add(x[i], y[i]);
+					if (command.shape == Shape::Rect)
+						extent.Add(x[i] + z[i], y[i] + w[i]);
+					else
+						extent.Add(z[i], w[i]);
+				}
+				break;
+			}
+			case Shape::Circle: {
+				for (uint32_t i = 0; i < command.count; i++) {
+					auto r = std::abs(z[i]);
+					extent.Add(x[i] - r, y[i] - r);
+					extent.Add(x[i] + r, y[i] + r);
+				}
+				break;
+			}
+			}
+			return extent.Box(StrokeMargin(command.paint, command.lineWidth));
 		}
 
-		Text& SetAlignment(ALIGNMENT alignment, Vector2 range = { 0.0 + PDF_PADDING,  PDF_WIDTH - PDF_PADDING }) {
-			this->m_alignment = alignment;
-			this->m_range = range;
-			return *this;
+		std::optional<BoundingBox> Bounds(const ImageCommand& command) const {
+			return BoundingBox{ command.position, command.size };
 		}
 
-		Text& SetAlignment(float depth, ALIGNMENT alignment, Vector2 range = { 0.0 + PDF_PADDING,  PDF_WIDTH - PDF_PADDING }) {
-			this->m_alignment = alignment;
-			this->m_range = range;
-			this->m_startPosition.y = PDF_HEIGHT - depth;
-			return *this;
+		// state changes and raw script are never culled
+		template<class T>
+		std::optional<BoundingBox> Bounds(const T&) const {
+			return std::nullopt;
 		}
 
-		Text& SetCharInterval(float charItvl) {
-			m_charItvlRatio = charItvl;
-			for (auto& ch : m_text) {
-				ch.charItvlRatio = charItvl;
-				auto interval = (charItvl > 1.0) ? (charItvl - 1.0) * ch.fontSize : 0.0;
-				ch.length = ch.charLen + interval;
-			}
-			return *this;
+		bool Visible(const DisplayList::Command& command) {
+			auto bounds = std::visit([this](const auto& c) { return Bounds(c); }, command);
+			if (!bounds)
+				return true;
+
+			const auto& state = m_states.back();
+			if (!state.clip.Empty() && state.clip.Intersects(bounds->Translated(state.translation)))
+				return true;
+
+			m_stats->commands++;
+			if (std::holds_alternative<TextRunCommand>(command))
+				m_stats->textRuns++;
+			return false;
 		}
 
-		Text& SetLineInterval(float lineItvl) {
-			m_lineItvl = lineItvl;
-			return *this;
+		// rounds half away from zero like FormatNumber, false if a value is out of the int32 range or nan
+		static bool ScaleColumn(std::span<const float> values, double scale, int32_t* units) {
+			bool fits = true;
+			for (size_t i = 0; i < values.size(); i++) {
+				auto scaled = values[i] * scale;
+				auto clamped = std::min(2e9, std::max(-2e9, scaled));
+				fits &= (clamped == scaled);
+				units[i] = static_cast<int32_t>(clamped + (clamped < 0 ? -0.5 : 0.5));
+			}
+			return fits;
 		}
 
-	public:
-		Vector2 Size() { return m_size; }
-		Vector2 Size() const { return m_size; }
+		char* Put(char* buffer, char* p, float value) {
+			return FormatNumber(p, value, m_precision);
+		}
 
-		int32_t Count() { return m_componentCount; }
-		int32_t Count() const { return m_componentCount; }
+		char* Put(char* buffer, char* p, std::string_view text) {
+			if (text.size() <= 32) {
+				return std::copy(text.begin(), text.end(), p);
+			}
+			m_out.append(buffer, p);
+			m_out.append(text);
+			return buffer;
+		}
 
-		std::string_view Content() { return m_content; }
-		std::string_view Content() const { return m_content; }
+	private:
+		// the translation and the clip, in page space, of every saved graphics state
+		struct State {
+			Vector2 translation;
+			BoundingBox clip;
+		};
 
-		Vector2 StartPosition() { return m_startPosition; }
-		Vector2 StartPosition() const { return m_startPosition; }
+		const DisplayList& m_list;
+		std::pmr::string& m_out;
+		int m_precision;
+		// culling is off without stats
+		CullStats* m_stats = nullptr;
+		std::vector<State> m_states;
+	};
 
-	private:
-		// text content management member
-		std::wstring m_vanillaText;
-		std::vector<Character> m_text;
-	private:
-		// text space layout management member
-		float m_fontSize;
-		size_t m_lineCount = {};
-		Vector2 m_range = {};
-		ALIGNMENT m_alignment = ALIGNMENT::DEFAULT;
-	private:
-		float m_charItvlRatio;
-		float m_lineItvl;
-	private:
-		// text style management member
-		TextStyle m_textStyle;
-	private:
-		bool m_autoNextPage = false;
+	enum class ALIGNMENT {
+		DEFAULT,
+		LEFT,
+		CENTER,
+		RIGHT,
 	};
 
-	class Streak : Component<Streak> {
-	public:
+	enum class FIGURE {
+		DEFAULT,
+		TEXT,
+		RECT,
+		LINE,
+		IMAGE
+	};
+
+	enum class TOOTH_IMAGE {
+		NORMAL,
+		ATTACHMENT,
+		MISSING
+	};
+
+	// PDF Canvas Size
+	const size_t PDF_WIDTH = 707;
+	const size_t PDF_HEIGHT = 1000;
+	const size_t PDF_BOTTOM = 900;
+	// the media box, the same box in depth and in pdf coordinates
+	const BoundingBox PDF_PAGE_BOX = { { 0.0, 0.0 }, { PDF_WIDTH, PDF_HEIGHT } };
+	// components are culled only this far off the page, their bounds leave out half the stroke
+	const float PDF_CULL_MARGIN = 1.0;
+
+	// Padding 
+	const size_t PDF_PADDING = 50;
+	const size_t PDF_LINE_PADDING = 8;
+	const size_t PDF_SECTION_PADDING = 20;
+	
+	struct TextStyle {
+		bool bold = false;
+		bool itallic = false;
+		bool underline = false;
+		ALIGNMENT alignment = ALIGNMENT::DEFAULT;
+		Vector2 alignmentRange = { 0.0 + PDF_PADDING,  PDF_WIDTH - PDF_PADDING };
+	};
+
+	struct AttachmentInfo {
+		AttachmentInfo(int32_t fdi, const std::string& attName, int32_t startStep, int32_t endStep)
+			: fdi(fdi), attName(attName), startStep(startStep), endStep(endStep) {}
+
+		int32_t fdi = {};
+		int32_t startStep = {}, endStep = {};
+		std::string attName;
+	};
+
+	struct ImageInfo {
+		std::string m_imageId;
+		Vector2 horzRange = {};
+		Vector2 drawPosition = {};
+		int32_t width = {}, height = {};
+		float scaling = 1.0;
+	};
+
+	std::string UnicodeToUtf8(const std::wstring_view wstr) {
+#ifdef USE_LXD
+		return lxd::utf8_encode(wstr);
+#else 
+		std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+		return converter.to_bytes(std::wstring(wstr));
+#endif
+	}
+
+	std::wstring Utf8ToUnicode(const std::string_view str) {
+#ifdef USE_LXD
+		return lxd::utf8_decode(str);
+#else 
+		std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+		return converter.from_bytes(std::string(str));
+#endif
+	}
+
+	// reads the header of an image straight from the mapped file, false if it can't be read
+	bool ReadImageInfo(std::string_view path, int32_t& width, int32_t& height, int32_t& comp) {
+		lxd::MappedFile file(Utf8ToUnicode(path));
+		if (!file.isOpen())
+			return false;
+		// stb takes an int length, the header is all it reads anyway
+		auto size = static_cast<int>(std::min<size_t>(file.size(), std::numeric_limits<int>::max()));
+		return stbi_info_from_memory(reinterpret_cast<const stbi_uc*>(file.data()), size, &width, &height, &comp) != 0;
+	}
+
+	struct ImageHeader {
+		bool valid = false;
+		int32_t width = 0, height = 0, comp = 0;
+	};
+
+	// The headers of the images read so far, by path. An entry never changes once added, so the reports of
+	// a batch read every image file once between them instead of once each
+	ImageHeader GetImageHeader(const std::string& path) {
+		static std::shared_mutex mutex;
+		static std::unordered_map<std::string, ImageHeader> headers;
+		{
+			std::shared_lock lock(mutex);
+			auto it = headers.find(path);
+			if (it != headers.end())
+				return it->second;
+		}
+		ImageHeader header;
+		header.valid = ReadImageInfo(path, header.width, header.height, header.comp);
+		// missing images are asked for again, they may show up later
+		if (header.valid) {
+			std::unique_lock lock(mutex);
+			headers.try_emplace(path, header);
+		}
+		return header;
+	}
+
+	// The widths of the printable ASCII characters in the screen font, measured once for the process.
+	// Never written afterwards, so every document reads them from any thread without a lock
+	class FontMetrics {
+	public:
+		FontMetrics() {
+#ifdef _WIN32
+			auto hdc = GetDC(NULL);
+			for (char ch = (char)33; ch < (char)126; ch++) {
+				SIZE sz;
+				GetTextExtentPoint32(hdc, &ch, 1, &sz);
+				m_widths[ch] = sz.cx;
+			}
+			ReleaseDC(NULL, hdc);
+#else
+			// no screen font to measure, the Times-Roman advance widths (per 1000 em) the pages are set in,
+			// scaled to the 16 px the screen font is measured at
+			static constexpr uint16_t timesRoman[] = {
+				333, 408, 500, 500, 833, 778, 333, 333, 333, 500, 564, 250, 333, 250, 278,
+				500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 278, 278, 564, 564, 564, 444,
+				921, 722, 667, 667, 722, 611, 556, 722, 722, 333, 389, 722, 611, 889, 722, 722,
+				556, 722, 667, 556, 611, 722, 722, 944, 722, 722, 611, 333, 278, 333, 469, 500,
+				333, 444, 500, 444, 500, 444, 333, 500, 500, 278, 278, 500, 278, 778, 500, 500,
+				500, 500, 333, 389, 278, 500, 500, 722, 500, 500, 444, 480, 200, 480
+			};
+			for (char ch = (char)33; ch < (char)126; ch++)
+				m_widths[ch] = timesRoman[ch - 33] * 16 / 1000.0f;
+#endif
+		}
+
+		// 0 for the characters that weren't measured
+		float Width(char ch) const {
+			return (ch > 0) ? m_widths[ch] : 0.0f;
+		}
+
+		// the measured widths as they are in memory, so caches can tell a different font apart
+		std::string_view Bytes() const {
+			return { reinterpret_cast<const char*>(m_widths.data()), sizeof(m_widths) };
+		}
+
+	private:
+		std::array<float, 128> m_widths{};
+	};
+
+	const FontMetrics& GetFontMetrics() {
+		static const FontMetrics metrics;
+		return metrics;
+	}
+
+	// FNV-1a, stable across runs and platforms unlike std::hash
+	inline uint64_t Fnv1a(std::string_view bytes) {
+		uint64_t hash = 14695981039346656037ull;
+		for (auto ch : bytes) {
+			hash = (hash ^ static_cast<uint8_t>(ch)) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	// images loaded from a path are named after it, the same name in every document and on every thread
+	std::string ImageName(std::string_view path) {
+		return fmt::format("I{:016x}", Fnv1a(path));
+	}
+
+	LANGUAGE GetLanguage(uint32_t unicode) {
+		auto inRange = [](uint32_t uc, uint32_t rBeg, uint32_t rEnd) {
+			if (rBeg > rEnd) std::swap(rBeg, rEnd);
+			return uc >= rBeg && uc <= rEnd;
+		};
+
+		// Basic Chinese Unicode Range
+		if (inRange(unicode, 0x4E00, 0x9FA5) ||
+			inRange(unicode, 0xFF01, 0xFF1B) ||
+			inRange(unicode, 0x3001, 0x300F) ||
+			inRange(unicode, 0x2018, 0x201D)) {
+			return LANGUAGE::CHINESE;
+		}
+		else if ((unicode == '\n') || (unicode == '\r') || (unicode == '\t')) {
+			return LANGUAGE::ESCAPE_CHAR;
+		}
+		else if (unicode == ' ') {
+			return LANGUAGE::SPACING;
+		}
+		else {
+			return LANGUAGE::ENGLISH;
+		}
+	}
+
+	template<class T>
+	class Component {
+	public:
+		Component() = default;
+
+		Component(Vector2 startPosition, Vector2 size = { 0.0, 0.0 })
+			: m_startPosition(startPosition), m_size(size)
+		{
+		}
+
+		Vector2 Size() const { return static_cast<T*>(this)->Size(); }
+
+		std::vector<DisplayList> GetContent() const { return static_cast<T*>(this)->GetContent(); }
+
+		Vector2 StartPosition() const { return static_cast<T*>(this)->StartPosition(); }
+
+		BoundingBox Bounds() const { return static_cast<const T*>(this)->Bounds(); }
+
+	public:
+		template<component U>
+		T& Append(U component) { static_cast<U*>(this)->Append(component); return static_cast<T&>(*this); }
+
+	protected:
+		Vector2 m_size;
+		Vector2 m_startPosition;
+	};
+
+	class Character {
+	public:
+		// regular i
+		Character(const wchar_t character, LANGUAGE lang, float fontSize, float charItvlRatio, bool bold)
+			: lang(lang), fontSize(fontSize), charItvlRatio(charItvlRatio), bold(bold)
+		{
+			auto interval = (charItvlRatio > 1.0) ? (charItvlRatio - 1.0) * fontSize : 0.0;
+
+			// font size calculation
+			if (lang == LANGUAGE::CHINESE) {
+				this->charLen = fontSize;
+				this->length = fontSize + interval;
+
+				this->content = character;
+			}
+			else if (lang == LANGUAGE::ENGLISH) {
+				auto magicNumber = 1.05;
+				this->charLen = GetFontMetrics().Width((char)character) * (fontSize / 16.0) * magicNumber;
+				this->length = this->charLen + interval;
+
+				this->content = (char)character;
+			}
+			else if (lang == LANGUAGE::ESCAPE_CHAR) {
+				if (character == L'\t') {
+					this->fontSize = 0.0;
+					this->charLen = this->length = 2.0 * fontSize;
+				}
+				else {
+					this->charLen = this->length = this->fontSize = 0.0;
+				}
+				this->content = (char)character;
+			}
+			else if (lang == LANGUAGE::SPACING) {
+				this->length = this->charLen = 0.3 * fontSize;
+			}
+		}
+
+		// Spacing constructor
+		Character(LANGUAGE lang, float spacing) : lang(lang) {
+			this->length = this->charLen = spacing;
+		}
+
+	public:
+		// character language
+		LANGUAGE lang;
+		// bare character length
+		float charLen;
+		// total length of a single character: including the character intervals
+		float length;
+		// character fontSize(not the same as charLen)
+		float fontSize;
+		// the interval between characters
+		float charItvlRatio;
+		// characters absolute position on pdf canvas
+		Vector2 position;
+		// the character style
+		bool bold = false;
+		// the final content output to txt file, CJK characters are hex encoded on output
+		std::variant<char, wchar_t> content;
+	};
+
+	class Text : Component<Text> {
+	public:
+		Text() : m_fontSize(12.0), m_range(Vector2{ PDF_PADDING, PDF_WIDTH - PDF_PADDING }), m_charItvlRatio(1.0), m_lineItvl(1.2) {}
+
+		Text(const std::wstring_view text, float fontSize, float charNumIndent = 0.0, bool bold = false)
+			: m_vanillaText(text), m_fontSize(fontSize),
+			m_range(Vector2{ PDF_PADDING, PDF_WIDTH - PDF_PADDING }),
+			m_charItvlRatio(1.0), m_lineItvl(1.2)
+		{
+			float indent = charNumIndent * m_fontSize;
+			m_text.emplace_back(LANGUAGE::SPACING, indent);
+
+			for (const auto& ch : m_vanillaText) {
+				auto lang = GetLanguage(ch);
+				m_text.emplace_back(ch, lang, m_fontSize, m_charItvlRatio, bold);
+			}
+		}
+
+		Text(const std::wstring_view text, float fontSize, Vector2 pos, bool bold = false)
+			: Component(pos), m_vanillaText(text), m_fontSize(fontSize),
+			m_range(Vector2{ PDF_PADDING, PDF_WIDTH - PDF_PADDING }), m_charItvlRatio(1.0), m_lineItvl(1.2)
+		{
+			m_startPosition.y = PDF_HEIGHT - pos.y;
+
+			for (const auto& ch : m_vanillaText) {
+				auto lang = GetLanguage(ch);
+				m_text.emplace_back(ch, lang, m_fontSize, m_charItvlRatio, bold);
+			}
+		}
+
+		Text(const std::wstring_view text, float fontSize, float depth, ALIGNMENT alignment, bool bold = false)
+			: Component({ 0, depth }), m_vanillaText(text), m_fontSize(fontSize),
+			m_range(Vector2{ PDF_PADDING, PDF_WIDTH - PDF_PADDING }), m_charItvlRatio(1.0), m_lineItvl(1.2), m_alignment(alignment)
+		{
+			m_startPosition.y = PDF_HEIGHT - depth;
+
+			for (const auto& ch : m_vanillaText) {
+				auto lang = GetLanguage(ch);
+				m_text.emplace_back(ch, lang, m_fontSize, m_charItvlRatio, bold);
+			}
+		}
+
+	public:
+		void CalcLayout() {
+			m_lineCount = 0;
+			m_left = m_range.x;
+			// an empty text has no line to align, e.g. a table cell AddRow padded
+			if (m_text.empty()) {
+				m_size = {};
+				return;
+			}
+
+			// m_range defaults to the padded page width, SetAlignment narrows it (e.g. table cells)
+			if (m_alignment == ALIGNMENT::DEFAULT) {
+				m_range = Vector2{ m_startPosition.x, PDF_WIDTH - PDF_PADDING };
+				m_left = m_range.x;
+			}
+
+			// every alignment wraps into m_range, lines are aligned afterwards
+			std::vector<size_t> lineStarts = { 0 };
+			Vector2 curPos = { m_range.x, m_startPosition.y };
+			for (size_t i = 0; i < m_text.size(); i++) {
+				auto& ch = m_text[i];
+				bool lineOverflow = static_cast<int>(curPos.x + ch.charLen) > m_range.y;
+				bool EOL = (ch.lang == LANGUAGE::ESCAPE_CHAR) && (std::get<char>(ch.content) == '\n');
+
+				if (lineOverflow || EOL) {
+					m_lineCount++;
+					lineStarts.push_back(i);
+					curPos.y -= m_fontSize * m_lineItvl;
+					curPos.x = m_range.x;
+
+					if (m_autoNextPage && (curPos.y < PDF_PADDING)) {
+						curPos.x = m_range.x;
+						curPos.y = PDF_HEIGHT - PDF_PADDING;
+					}
+				}
+
+				ch.position = curPos;
+				curPos.x += ch.length;
+			}
+
+			if (m_alignment == ALIGNMENT::CENTER || m_alignment == ALIGNMENT::RIGHT) {
+				m_left = m_range.y;
+				lineStarts.push_back(m_text.size());
+				for (size_t line = 0; line + 1 < lineStarts.size(); line++) {
+					auto first = lineStarts[line], last = lineStarts[line + 1];
+					float lineLength = {};
+					for (auto i = first; i < last; i++)
+						lineLength += m_text[i].length;
+
+					// the interval after the last character is not part of the line
+					auto itvlCompensation = m_text[last - 1].length - m_text[last - 1].charLen;
+					auto slack = std::max(m_range.y - m_range.x - lineLength + itvlCompensation, 0.0f);
+					auto offset = (m_alignment == ALIGNMENT::CENTER) ? slack / 2.0f : slack;
+					for (auto i = first; i < last; i++)
+						m_text[i].position.x += offset;
+					m_left = std::min(m_left, m_range.x + offset);
+				}
+			}
+
+			m_size = Measure(m_range);
+		}
+
+		// Measures the extent of the text wrapped into range without touching the layout state,
+		// returns { widest line, total height }. The height runs from the top of the first line to
+		// the last baseline, Table's cell padding leaves the room for descenders
+		Vector2 Measure(Vector2 range) const {
+			if (m_text.empty()) return {};
+
+			float curX = range.x, lineLength = {}, maxLineLength = {};
+			size_t lineCount = 1;
+			for (const auto& ch : m_text) {
+				bool lineOverflow = static_cast<int>(curX + ch.charLen) > range.y;
+				bool EOL = (ch.lang == LANGUAGE::ESCAPE_CHAR) && (std::get<char>(ch.content) == '\n');
+
+				if (lineOverflow || EOL) {
+					maxLineLength = std::max(maxLineLength, lineLength);
+					lineCount++;
+					curX = range.x;
+					lineLength = {};
+				}
+
+				curX += ch.length;
+				lineLength += ch.length;
+			}
+			maxLineLength = std::max(maxLineLength, lineLength);
+
+			return { maxLineLength, m_fontSize + (lineCount - 1) * m_fontSize * m_lineItvl };
+		}
+
+		// Records the runs straight into list, a text that runs over the page (SetAutoNextPage)
+		// continues in the list returned by nextPage()
+		template<class NextPage>
+		void Record(DisplayList& list, NextPage&& nextPage) const {
+			if (!m_text.size()) return;
+
+			auto ret = &list;
+
+			// state control vars
+			auto preLang = m_text[0].lang;
+			auto prePos = m_text[0].position;
+			auto preBold = m_text[0].bold;
+			auto xInc = m_range.x;
+			// a run is collected here and copied once, into the list's pool
+			thread_local std::string buffer;
+			buffer.clear();
+
+			// дļlambda func
+			auto writeToFile = [&](int32_t i) {
+				// spacing char
+				if (preLang == LANGUAGE::SPACING) {
+					preLang = m_text[i].lang;
+					prePos = m_text[i].position;
+					return;
+				}
+
+				auto writable = (preLang == LANGUAGE::CHINESE) || (preLang == LANGUAGE::ENGLISH);
+
+				auto font = (preLang == LANGUAGE::CHINESE) ? Font::Song : Font::TmRm;
+				auto hex = (preLang == LANGUAGE::CHINESE);
+
+				// a single character text flushes at i == 0
+				auto bufferFontSize = m_text[std::max(i - 1, 0)].fontSize;
+				auto charItvl = (m_charItvlRatio - 1.0f) * bufferFontSize;
+
+				// draw content
+				if (writable && !buffer.empty()) {
+					ret->RecordText(font, bufferFontSize, prePos, charItvl, buffer, hex);
+
+					if (preBold) {
+						auto offset = 0.2f * (bufferFontSize / 16.0f);
+						ret->RecordText(font, bufferFontSize, { prePos.x + offset, prePos.y }, charItvl, buffer, hex);
+						ret->RecordText(font, bufferFontSize, { prePos.x - offset, prePos.y }, charItvl, buffer, hex);
+						ret->RecordText(font, bufferFontSize, { prePos.x, prePos.y + offset }, charItvl, buffer, hex);
+						ret->RecordText(font, bufferFontSize, { prePos.x, prePos.y - offset }, charItvl, buffer, hex);
+					}
+				}
+
+				// state update
+				preBold = m_text[i].bold;
+				preLang = m_text[i].lang;
+				prePos = m_text[i].position;
+
+				buffer.clear();
+			};
+
+			// main process
+			for (int32_t i = 0; i < m_text.size(); i++) {
+				bool EOL = (m_text[i].lang == LANGUAGE::ESCAPE_CHAR) && (std::get<char>(m_text[i].content) == '\n');
+				bool overflow = static_cast<int>(xInc + m_text[i].charLen) > m_range.y;
+
+				auto BufferAppend = [&]() {
+					if (m_text[i].lang == LANGUAGE::CHINESE)
+						fmt::format_to(std::back_inserter(buffer), "{:x}", static_cast<uint32_t>(std::get<wchar_t>(m_text[i].content)));
+					else if (m_text[i].lang == LANGUAGE::ENGLISH) {
+						// mutoolͻַת
+						auto ch = std::get<char>(m_text[i].content);
+						if (ch == '(' || ch == ')' || ch == '\\')
+							buffer += '\\';
+						buffer += ch;
+					}
+				};
+
+				if (overflow || EOL) {
+					writeToFile(i);
+
+					if (m_autoNextPage && (i > 0) && (m_text[i].position.y > m_text[i - 1].position.y)) {
+						ret = &nextPage();
+					}
+
+					BufferAppend();
+
+					xInc = m_range.x;
+					xInc += m_text[i].length;
+
+					if (i == m_text.size() - 1)
+						writeToFile(i);
+
+					continue;
+				}
+
+				// text style differ
+				if (preBold != m_text[i].bold) {
+					writeToFile(i);
+				}
+
+				// languages differ
+				if (preLang != m_text[i].lang) {
+					writeToFile(i);
+				}
+
+				// character appending
+				BufferAppend();
+
+				// β
+				if ((i == m_text.size() - 1) && !buffer.empty()) {
+					writeToFile(i);
+				}
+
+				xInc += m_text[i].length;
+			}
+		}
+
+		// Records a text that stays on one page, for the components that place it as a block (table
+		// cells, captions, containers). A text set to SetAutoNextPage continues on further pages only
+		// through Record(list, nextPage), here a copy is laid out without it
+		void Record(DisplayList& list) const {
+			if (m_autoNextPage) {
+				auto text = *this;
+				text.SetAutoNextPage(false).CalcLayout();
+				text.Record(list);
+				return;
+			}
+			Record(list, [&list]() -> DisplayList& { return list; });
+		}
+
+		std::vector<DisplayList> GetContent() const {
+			std::vector<DisplayList> textVec;
+			if (m_text.empty()) return textVec;
+
+			textVec.emplace_back();
+			Record(textVec.front(), [&textVec]() -> DisplayList& { return textVec.emplace_back(); });
+			return textVec;
+		}
+
+	public:
+		float GetLength() {
+			float length{};
+			for (const auto& ch : m_text)
+				length += ch.length;
+			return length;
+		}
+
+		float GetFontSize() const {
+			return m_fontSize;
+		}
+
+		// the distance between two baselines
+		float GetLineHeight() const {
+			return m_fontSize * m_lineItvl;
+		}
+
+		Vector2 GetLastCharPosition() const {
+			return m_text.back().position;
+		}
+
+		float GetBottom() const {
+			if (!m_text.empty()) {
+				return m_text.back().position.y;
+			}
+			else {
+				return PDF_HEIGHT - PDF_PADDING;
+			}
+		}
+
+		bool Empty() const {
+			return (m_text.size() == 0);
+		}
+
+	public:
+		// Text manipulation
+		Text& Append(const std::wstring_view text, bool bold = false) {
+			for (const auto& ch : text) {
+				auto lang = GetLanguage(ch);
+				m_text.emplace_back(ch, lang, m_fontSize, m_charItvlRatio, bold);
+			}
+			return *this;
+		}
+
+		Text& SetFontSize(float fontSize) {
+			m_fontSize = fontSize;
+			for (auto& ch : m_text) {
+				ch.fontSize = fontSize;
+			}
+			return *this;
+		}
+
+		Text& Space(float spacing = 0.0) {
+			m_text.emplace_back(LANGUAGE::SPACING, spacing);
+			return *this;
+		}
+
+		Text& SetIndent(float charNum) {
+			auto indentLen = charNum * m_fontSize;
+			m_text.emplace_back(LANGUAGE::SPACING, indentLen);
+			return *this;
+		}
+
+		Text& NextLine() {
+			m_text.emplace_back(L'\n', LANGUAGE::ESCAPE_CHAR, 0.0, 0.0, false);
+			return *this;
+		}
+
+		Text& SetAutoNextPage(bool flag) {
+			m_autoNextPage = flag;
+			return *this;
+		}
+
+		Text& SetDepth(float depth) {
+			m_startPosition.y = PDF_HEIGHT - depth;
+			return *this;
+		}
+
+		Text& SetPosition(Vector2 position) {
+			m_startPosition = position;
+			auto depth = FLOAT_EQUAL(m_startPosition.y, 0.0) ? PDF_PADDING : m_startPosition.y;
+			m_startPosition.y = PDF_HEIGHT - depth;
+			return *this;
+		}
+
+		Text& SetAlignment(ALIGNMENT alignment, Vector2 range = { 0.0 + PDF_PADDING,  PDF_WIDTH - PDF_PADDING }) {
+			this->m_alignment = alignment;
+			this->m_range = range;
+			return *this;
+		}
+
+		Text& SetAlignment(float depth, ALIGNMENT alignment, Vector2 range = { 0.0 + PDF_PADDING,  PDF_WIDTH - PDF_PADDING }) {
+			this->m_alignment = alignment;
+			this->m_range = range;
+			this->m_startPosition.y = PDF_HEIGHT - depth;
+			return *this;
+		}
+
+		Text& SetCharInterval(float charItvl) {
+			m_charItvlRatio = charItvl;
+			for (auto& ch : m_text) {
+				ch.charItvlRatio = charItvl;
+				auto interval = (charItvl > 1.0) ? (charItvl - 1.0) * ch.fontSize : 0.0;
+				ch.length = ch.charLen + interval;
+			}
+			return *this;
+		}
+
+		Text& SetLineInterval(float lineItvl) {
+			m_lineItvl = lineItvl;
+			return *this;
+		}
+
+	public:
+		Vector2 Size() { return m_size; }
+		Vector2 Size() const { return m_size; }
+
+		Vector2 StartPosition() { return m_startPosition; }
+		Vector2 StartPosition() const { return m_startPosition; }
+
+		// valid after CalcLayout, the box starts one font size above the first baseline
+		BoundingBox Bounds() const { return { { m_left, PDF_HEIGHT - m_startPosition.y - m_fontSize }, m_size }; }
+
+	private:
+		// text content management member
+		std::wstring m_vanillaText;
+		std::vector<Character> m_text;
+	private:
+		// text space layout management member
+		float m_fontSize;
+		size_t m_lineCount = {};
+		Vector2 m_range = {};
+		// start of the widest line once aligned within m_range
+		float m_left = {};
+		ALIGNMENT m_alignment = ALIGNMENT::DEFAULT;
+	private:
+		float m_charItvlRatio;
+		float m_lineItvl;
+	private:
+		// text style management member
+		TextStyle m_textStyle;
+	private:
+		bool m_autoNextPage = false;
+	};
+
+	class Streak : Component<Streak> {
+	public:
 		Streak(Vector2 startPosition, Vector2 endPosition, Vector3 color = Vector3{ 0.0, 0.0, 0.0 })
-			: Component(startPosition), m_endPosition(endPosition)
+			: Component(startPosition), m_endPosition(endPosition), m_color(color)
+		{
+			m_startPosition.y = PDF_HEIGHT - m_startPosition.y;
+			m_endPosition.y = PDF_HEIGHT - m_endPosition.y;
+		}
+
+	public:
+		void Record(DisplayList& list) const {
+			list.RecordLine(1.0, m_color, m_startPosition, m_endPosition);
+		}
+
+		std::vector<DisplayList> GetContent() const {
+			std::vector<DisplayList> content(1);
+			Record(content.front());
+			return content;
+		}
+
+	public:
+		Vector2 Size() { return m_size; }
+		Vector2 Size() const { return m_size; }
+
+		Vector2 StartPosition() { return m_startPosition; }
+		Vector2 StartPosition() const { return m_startPosition; }
+
+		BoundingBox Bounds() const {
+			auto left = std::min(m_startPosition.x, m_endPosition.x), top = std::max(m_startPosition.y, m_endPosition.y);
+			return { { left, PDF_HEIGHT - top }, { std::abs(m_endPosition.x - m_startPosition.x), std::abs(m_endPosition.y - m_startPosition.y) } };
+		}
+
+	private:
+		Vector2 m_endPosition;
+		Vector3 m_color;
+	};
+
+	class Rect : Component<Rect> {
+	public:
+		enum class Type {
+			Block,
+			Outline,
+			BackGround
+		};
+
+	public:
+		Rect(Vector2 startPosition, Vector2 size, Vector3 color, Rect::Type type)
+			: Component(startPosition, size), m_type(type), m_color(color)
+		{
+			m_startPosition.y = PDF_HEIGHT - m_startPosition.y;
+		}
+
+	public:
+		void Record(DisplayList& list) const {
+			Vector2 corner = { m_startPosition.x, m_startPosition.y - m_size.y };
+
+			switch (m_type) {
+			case Type::Block:
+			case Type::BackGround: {
+				list.RecordRect(Paint::Fill, 0.0, m_color, corner, m_size);
+				break;
+			}
+			case Type::Outline: {
+				list.RecordRect(Paint::Stroke, 0.8, m_color, corner, m_size);
+				break;
+			}
+			}
+		}
+
+		std::vector<DisplayList> GetContent() const {
+			std::vector<DisplayList> content(1);
+			Record(content.front());
+			return content;
+		}
+
+	public:
+		Vector2 Size() { return m_size; }
+		Vector2 Size() const { return m_size; }
+
+		Vector2 StartPosition() { return m_startPosition; }
+		Vector2 StartPosition() const { return m_startPosition; }
+
+		BoundingBox Bounds() const { return { { m_startPosition.x, PDF_HEIGHT - m_startPosition.y }, m_size }; }
+	public:
+		Type m_type;
+		Vector3 m_color;
+	};
+
+	class Circle : Component<Circle> {
+	public:
+		Circle(Vector2 startPosition, float radius, Vector3 color)
+			: m_radius(radius), m_color(color)
+		{
+			m_startPosition = startPosition;
+			m_startPosition.y = PDF_HEIGHT - m_startPosition.y;
+		}
+
+	public:
+		// the start position is the leftmost point of the circle
+		void Record(DisplayList& list) const {
+			list.RecordCircle(Paint::Fill, 0.01, m_color, { m_startPosition.x + m_radius, m_startPosition.y }, m_radius);
+		}
+
+		std::vector<DisplayList> GetContent() const {
+			std::vector<DisplayList> content(1);
+			Record(content.front());
+			return content;
+		}
+
+	public:
+		Vector2 Size() { return m_size; }
+		Vector2 Size() const { return m_size; }
+
+		Vector2 StartPosition() { return m_startPosition; }
+		Vector2 StartPosition() const { return m_startPosition; }
+
+		// the path starts at the leftmost point of the circle
+		BoundingBox Bounds() const {
+			return { { m_startPosition.x, PDF_HEIGHT - m_startPosition.y - m_radius }, { 2 * m_radius, 2 * m_radius } };
+		}
+	public:
+		float m_radius = {};
+		Vector3 m_color = {};
+	};
+
+	// Many rects, lines or circles sharing one style, kept as structure of arrays in pdf space and
+	// recorded as a single BatchCommand. Grids, timelines and chart markers go through here instead
+	// of one Rect, Streak or Circle with its own graphics state each
+	class Batch : Component<Batch> {
+	public:
+		Batch(Shape shape, Paint paint, Vector3 color, float lineWidth = 1.0)
+			: m_shape(shape), m_paint(shape == Shape::Line ? Paint::Stroke : paint), m_lineWidth(lineWidth), m_color(color) {}
+
+	public:
+		// position is the top-left corner
+		Batch& AddRect(Vector2 position, Vector2 size) {
+			assert(m_shape == Shape::Rect);
+			Add({ position, size }, { position.x, PDF_HEIGHT - position.y - size.y, size.x, size.y });
+			return *this;
+		}
+
+		// boxes in depth coordinates like BoundingBox everywhere
+		Batch& AddRects(std::span<const BoundingBox> rects) {
+			Reserve(ItemCount() + rects.size());
+			for (const auto& rect : rects)
+				AddRect(rect.position, rect.size);
+			return *this;
+		}
+
+		Batch& AddLine(Vector2 from, Vector2 to) {
+			assert(m_shape == Shape::Line);
+			BoundingBox box = { from, {} };
+			Add(box.United({ to, {} }), { from.x, PDF_HEIGHT - from.y, to.x, PDF_HEIGHT - to.y });
+			return *this;
+		}
+
+		Batch& AddCircle(Vector2 center, float radius) {
+			assert(m_shape == Shape::Circle);
+			Add({ { center.x - radius, center.y - radius }, { 2 * radius, 2 * radius } }, { center.x, PDF_HEIGHT - center.y, radius });
+			return *this;
+		}
+
+		void Reserve(size_t count) {
+			for (auto& column : m_columns)
+				column.reserve(count);
+		}
+
+		size_t ItemCount() const {
+			return m_columns[0].size();
+		}
+
+	public:
+		void Record(DisplayList& list) const {
+			if (m_columns[0].empty())
+				return;
+
+			switch (m_shape) {
+			case Shape::Rect: list.RecordRects(m_paint, m_lineWidth, m_color, m_columns[0], m_columns[1], m_columns[2], m_columns[3]); break;
+			case Shape::Line: list.RecordLines(m_lineWidth, m_color, m_columns[0], m_columns[1], m_columns[2], m_columns[3]); break;
+			case Shape::Circle: list.RecordCircles(m_paint, m_lineWidth, m_color, m_columns[0], m_columns[1], m_columns[2]); break;
+			}
+		}
+
+		std::vector<DisplayList> GetContent() const {
+			std::vector<DisplayList> content(1);
+			Record(content.front());
+			return content;
+		}
+
+	private:
+		void Add(const BoundingBox& box, std::initializer_list<float> values) {
+			m_box = m_columns[0].empty() ? box : m_box.United(box);
+			auto column = m_columns.begin();
+			for (auto value : values)
+				(column++)->push_back(value);
+		}
+
+	public:
+		Vector2 Size() { return m_box.size; }
+		Vector2 Size() const { return m_box.size; }
+
+		Vector2 StartPosition() { return { m_box.Left(), PDF_HEIGHT - m_box.Top() }; }
+		Vector2 StartPosition() const { return { m_box.Left(), PDF_HEIGHT - m_box.Top() }; }
+
+		BoundingBox Bounds() const { return m_box; }
+
+	private:
+		Shape m_shape;
+		Paint m_paint;
+		float m_lineWidth;
+		Vector3 m_color;
+		std::array<std::vector<float>, 4> m_columns;
+		BoundingBox m_box;
+	};
+
+	// Builds a free-form path in depth coordinates like the other components, painted as a whole by
+	// a single fill or stroke
+	class Path : Component<Path> {
+	public:
+		Path(Paint paint, Vector3 color, float lineWidth = 1.0, FillRule rule = FillRule::NonZero)
+			: m_paint(paint), m_rule(rule), m_lineWidth(lineWidth), m_color(color) {}
+
+	public:
+		Path& MoveTo(Vector2 point) {
+			return Add(PathSegment::Type::Move, { point });
+		}
+
+		Path& LineTo(Vector2 point) {
+			return Add(PathSegment::Type::Line, { point });
+		}
+
+		Path& CurveTo(Vector2 control0, Vector2 control1, Vector2 point) {
+			return Add(PathSegment::Type::Curve, { control0, control1, point });
+		}
+
+		// a closed subpath of its own, position is the top-left corner
+		Path& AddRect(Vector2 position, Vector2 size) {
+			return Add({ PathSegment::Type::Rect, { { position.x, PDF_HEIGHT - position.y - size.y }, size } }, { position, size });
+		}
+
+		Path& Close() {
+			m_segments.push_back({ PathSegment::Type::Close, {} });
+			return *this;
+		}
+
+		void Reserve(size_t count) {
+			m_segments.reserve(count);
+		}
+
+	public:
+		void Record(DisplayList& list) const {
+			if (!m_segments.empty())
+				list.RecordPath(m_paint, m_lineWidth, m_color, m_segments, m_rule);
+		}
+
+		std::vector<DisplayList> GetContent() const {
+			std::vector<DisplayList> content(1);
+			Record(content.front());
+			return content;
+		}
+
+	private:
+		Path& Add(PathSegment::Type type, std::initializer_list<Vector2> points) {
+			PathSegment segment = { type, {} };
+			BoundingBox box = { *points.begin(), {} };
+			auto p = segment.points;
+			for (auto point : points) {
+				box = box.United({ point, {} });
+				*p++ = { point.x, PDF_HEIGHT - point.y };
+			}
+			return Add(segment, box);
+		}
+
+		Path& Add(const PathSegment& segment, const BoundingBox& box) {
+			m_box = m_segments.empty() ? box : m_box.United(box);
+			m_segments.push_back(segment);
+			return *this;
+		}
+
+	public:
+		Vector2 Size() { return m_box.size; }
+		Vector2 Size() const { return m_box.size; }
+
+		Vector2 StartPosition() { return { m_box.Left(), PDF_HEIGHT - m_box.Top() }; }
+		Vector2 StartPosition() const { return { m_box.Left(), PDF_HEIGHT - m_box.Top() }; }
+
+		// spans the control points as well, which contain the curves
+		BoundingBox Bounds() const { return m_box; }
+
+	private:
+		Paint m_paint;
+		FillRule m_rule;
+		float m_lineWidth;
+		Vector3 m_color;
+		std::vector<PathSegment> m_segments;
+		BoundingBox m_box;
+	};
+
+	// TODO: A total overhaul for lazy evaluation
+	class Image : Component<Image> {
+	public:
+		enum class Direction { Upwards, Downwards };
+
+	public:
+		Image(std::string_view m_imageId, Vector2 startPosition, Vector2 size, Direction drawDirection = Direction::Upwards)
+			: Component(startPosition, size), m_imageId(m_imageId), scaling(1.0), direction(drawDirection)
+		{
+			m_startPosition.y = PDF_HEIGHT - m_startPosition.y;
+			auto verticalStartPos = (direction == Direction::Upwards) ? m_startPosition.y : m_startPosition.y - m_size.y;
+			realDrawCoord = Vector2{ m_startPosition.x, verticalStartPos };
+		}
+
+		Image(std::string_view path, Vector2 startPosition, float imageHeight, Direction drawDirection = Direction::Upwards)
+			: Component(startPosition), scaling(1.0), direction(drawDirection)
+		{
+			m_startPosition.y = PDF_HEIGHT - m_startPosition.y;
+
+			// config size
+			auto header = GetImageHeader(std::string(path));
+			scaling = imageHeight / header.height;
+			auto width = header.width * scaling, height = imageHeight;
+			m_size = Vector2{ width , height };
+
+			auto verticalStartPos = (direction == Direction::Upwards) ? m_startPosition.y : m_startPosition.y - m_size.y;
+			realDrawCoord = Vector2{ m_startPosition.x, verticalStartPos };
+
+			auto name = ImageName(path);
+			if (std::filesystem::exists(path.data())) {
+				m_resource = fmt::format("%%Image {} {}\r\n", name, path);
+			}
+
+			m_imageId = fmt::format("/{}", name);
+		}
+
+	public:
+		Image& SetAlignment(ALIGNMENT alignment) {
+			switch (alignment) {
+			case ALIGNMENT::DEFAULT: {
+				break;
+			}
+			case ALIGNMENT::LEFT: {
+				realDrawCoord.x = PDF_PADDING;
+				break;
+			}
+			case ALIGNMENT::CENTER: {
+				realDrawCoord.x = PDF_WIDTH / 2.0 - m_size.x / 2.0;
+				break;
+			}
+			case ALIGNMENT::RIGHT: {
+				realDrawCoord.x = PDF_WIDTH - PDF_PADDING - m_size.x;
+				break;
+			}
+			}
+
+			return *this;
+		}
+
+		Image& AttachCaption(std::wstring_view caption, float fontSize = 12.0, ALIGNMENT alignment = ALIGNMENT::CENTER) {
+			float depth;
+
+			if (direction == Direction::Downwards) {
+				depth = realDrawCoord.y - fontSize * (1.0 + captionSpacing);
+				depth = PDF_HEIGHT - depth;
+			}
+			else {
+				depth = realDrawCoord.y + m_size.y + fontSize * captionSpacing;
+				depth = PDF_HEIGHT - depth;
+			}
+
+			m_caption.SetFontSize(fontSize).Append(caption)
+				.SetAlignment(depth, alignment, { realDrawCoord.x, realDrawCoord.x + m_size.x })
+				.CalcLayout();
+			m_caption.Record(m_attachments);
+			Attach(m_caption.Bounds());
+
+			return *this;
+		}
+
+		Image& SetCaptionSpacing(float spacing) {
+			captionSpacing = spacing;
+			return *this;
+		}
+
+		template<component U>
+		Image& Append(U component) {
+			component.Record(m_attachments);
+			Attach(component.Bounds());
+			return *this;
+		}
+
+	public:
+		float GetDrawPadding() const {
+			auto captionPadding = m_caption.Empty() ? 0.0 : m_caption.GetFontSize();
+			return PDF_SECTION_PADDING + captionPadding;
+		}
+
+	public:
+		void Record(DisplayList& list) const {
+			if (!m_resource.empty()) {
+				list.RecordRaw(m_resource);
+			}
+			list.RecordImage(m_imageId, realDrawCoord, m_size);
+			list.Append(m_attachments);
+		}
+
+		std::vector<DisplayList> GetContent() const {
+			std::vector<DisplayList> content(1);
+			Record(content.front());
+			return content;
+		}
+
+	public:
+		Vector2 Size() { return m_size; }
+		Vector2 Size() const { return m_size; }
+
+		Vector2 StartPosition() { return m_startPosition; }
+		Vector2 StartPosition() const { return m_startPosition; }
+
+		Vector2 RealDrawPosition() { return realDrawCoord; }
+		Vector2 RealDrawPosition() const { return realDrawCoord; }
+
+		// the image with its caption and appended components, everything Record draws
+		BoundingBox Bounds() const {
+			BoundingBox image{ { realDrawCoord.x, PDF_HEIGHT - realDrawCoord.y - m_size.y }, m_size };
+			return m_attachmentBox ? image.United(*m_attachmentBox) : image;
+		}
+
+	private:
+		void Attach(const BoundingBox& box) {
+			m_attachmentBox = m_attachmentBox ? m_attachmentBox->United(box) : box;
+		}
+
+	private:
+		Direction direction;
+		// the real draw position
+		Vector2 realDrawCoord;
+		// the id that's corresponding to the image path
+		std::string m_imageId;
+		// the image scaling 
+		float scaling;
+		// the %%Image directive of an image loaded from a path
+		std::string m_resource;
+		// the text caption that's attached to the 
+		Text m_caption;
+		// the caption and appended components, drawn after the image
+		DisplayList m_attachments;
+		std::optional<BoundingBox> m_attachmentBox;
+		// the spacing between the caption and the image
+		float captionSpacing = 0.5;
+	};
+
+	class Table : Component<Table> {
+	public:
+		enum class Width {
+			Fixed,
+			Auto,
+			Proportional
+		};
+
+		struct Column {
+			Width width = Width::Auto;
+			// points for Width::Fixed, weight for Width::Proportional, unused for Width::Auto
+			float value = 1.0;
+			ALIGNMENT alignment = ALIGNMENT::LEFT;
+		};
+
+	public:
+		Table(float depth, float fontSize = 12.0)
+			: Component({ PDF_PADDING, depth }), m_fontSize(fontSize), m_range(Vector2{ PDF_PADDING, PDF_WIDTH - PDF_PADDING })
+		{
+			m_startPosition.y = PDF_HEIGHT - depth;
+		}
+
+	public:
+		Table& AddColumn(Width width, float value = 1.0, ALIGNMENT alignment = ALIGNMENT::LEFT) {
+			m_columns.push_back(Column{ width, value, alignment });
+			return *this;
+		}
+
+		Table& AddRow(std::vector<std::wstring> cells) {
+			cells.resize(m_columns.size());
+			m_rows.push_back(std::move(cells));
+			return *this;
+		}
+
+		// the first count rows are repeated on top of every continuation page
+		Table& SetHeaderRows(size_t count) {
+			m_headerRows = count;
+			return *this;
+		}
+
+		Table& SetCellPadding(float padding) {
+			m_cellPadding = padding;
+			return *this;
+		}
+
+		Table& SetRange(Vector2 range) {
+			m_range = range;
+			return *this;
+		}
+
+		Table& SetGridStyle(Color3 color, float lineWidth = 0.8) {
+			m_gridColor = color;
+			m_lineWidth = lineWidth;
+			return *this;
+		}
+
+	public:
+		void CalcLayout() {
+			m_cellContents.clear();
+			m_placements.clear();
+			if (m_columns.empty() || m_rows.empty()) return;
+
+			const auto columnCount = m_columns.size();
+			const auto cellCount = m_rows.size() * columnCount;
+
+			// build and measure every cell concurrently
+			m_cells.clear();
+			m_cells.resize(cellCount);
+			std::vector<float> naturalWidths(cellCount);
+			ParallelFor(cellCount, [&](size_t i) {
+				const auto& column = m_columns[i % columnCount];
+				m_cells[i] = Text(m_rows[i / columnCount][i % columnCount], m_fontSize, 0.0, column.alignment);
+				if (column.width == Width::Auto)
+					naturalWidths[i] = m_cells[i].Measure({ 0.0, std::numeric_limits<float>::max() }).x;
+			});
+
+			SolveColumnWidths(naturalWidths);
+
+			std::vector<float> cellHeights(cellCount);
+			ParallelFor(cellCount, [&](size_t i) {
+				cellHeights[i] = m_cells[i].Measure(GetCellRange(i % columnCount)).y;
+			});
+
+			m_rowHeights.assign(m_rows.size(), 0.0);
+			for (size_t i = 0; i < cellCount; i++) {
+				auto& rowHeight = m_rowHeights[i / columnCount];
+				rowHeight = std::max(rowHeight, cellHeights[i] + 2 * m_cellPadding);
+			}
+
+			Paginate();
+
+			// lay out and record every placed cell concurrently, repeated header rows lay out a copy.
+			// the copies are taken from a snapshot, the header cells themselves are laid out meanwhile
+			const std::vector<Text> headerCells(m_cells.begin(), m_cells.begin() + std::min(m_headerRows, m_rows.size()) * columnCount);
+			m_cellContents.resize(m_placements.size() * columnCount);
+			ParallelFor(m_cellContents.size(), [&](size_t i) {
+				const auto& placement = m_placements[i / columnCount];
+				const auto column = i % columnCount;
+				// a continuation slice moves the lines already placed up above its top
+				const auto depth = placement.top + m_cellPadding + m_fontSize - placement.offset;
+
+				auto layout = [&](Text& cell) {
+					cell.SetAlignment(depth, m_columns[column].alignment, GetCellRange(column)).CalcLayout();
+					cell.Record(m_cellContents[i]);
+				};
+
+				if (placement.repeated) {
+					auto cell = headerCells[placement.row * columnCount + column];
+					layout(cell);
+				}
+				else if (placement.offset > 0.0) {
+					// the row's first slice lays out the cell itself meanwhile
+					Text cell(m_rows[placement.row][column], m_fontSize, 0.0, m_columns[column].alignment);
+					layout(cell);
+				}
+				else {
+					layout(m_cells[placement.row * columnCount + column]);
+				}
+			});
+		}
+
+		// concatenates the cells in order straight into list, closes every page with its grid
+		// and continues in the list returned by nextPage()
+		template<class NextPage>
+		void Record(DisplayList& list, NextPage&& nextPage) const {
+			const auto columnCount = m_columns.size();
+			auto page = &list;
+			size_t pageIndex = 0;
+			size_t first = 0;
+			while (first < m_placements.size()) {
+				auto last = first;
+				while (last < m_placements.size() && m_placements[last].page == m_placements[first].page)
+					last++;
+
+				// the first row may already have left the starting page
+				for (; pageIndex < m_placements[first].page; pageIndex++)
+					page = &nextPage();
+				for (auto p = first; p < last; p++) {
+					// a slice of a split row shows only its own lines, the writer culls the rest
+					const auto& placement = m_placements[p];
+					const bool split = placement.height != m_rowHeights[placement.row];
+					if (split) {
+						auto bottom = placement.top + placement.height - m_cellPadding;
+						page->PushClip({ m_columnEdges.front(), PDF_HEIGHT - bottom },
+							{ m_columnEdges.back() - m_columnEdges.front(), placement.height - 2 * m_cellPadding });
+					}
+					for (auto i = p * columnCount; i < (p + 1) * columnCount; i++)
+						page->Append(m_cellContents[i]);
+					if (split)
+						page->Pop();
+				}
+				AppendGrid(*page, first, last);
+
+				first = last;
+			}
+		}
+
+		std::vector<DisplayList> GetContent() const {
+			std::vector<DisplayList> pages;
+			if (m_placements.empty()) return pages;
+
+			pages.emplace_back();
+			Record(pages.front(), [&pages]() -> DisplayList& { return pages.emplace_back(); });
+			return pages;
+		}
+
+		float GetBottom() const {
+			if (m_placements.empty()) return m_startPosition.y;
+			const auto& placement = m_placements.back();
+			return PDF_HEIGHT - (placement.top + placement.height);
+		}
+
+	private:
+		void SolveColumnWidths(const std::vector<float>& naturalWidths) {
+			const auto columnCount = m_columns.size();
+			const auto available = m_range.y - m_range.x;
+			std::vector<float> widths(columnCount);
+
+			float fixedWidth = {}, autoWidth = {}, weights = {};
+			for (size_t c = 0; c < columnCount; c++) {
+				switch (m_columns[c].width) {
+				case Width::Fixed: {
+					widths[c] = m_columns[c].value;
+					fixedWidth += widths[c];
+					break;
+				}
+				case Width::Auto: {
+					for (size_t i = c; i < naturalWidths.size(); i += columnCount)
+						widths[c] = std::max(widths[c], naturalWidths[i]);
+					widths[c] += 2 * m_cellPadding;
+					autoWidth += widths[c];
+					break;
+				}
+				case Width::Proportional: {
+					weights += m_columns[c].value;
+					break;
+				}
+				}
+			}
+
+			// auto columns give way to fixed ones, proportional columns share what is left
+			auto remaining = available - fixedWidth - autoWidth;
+			if (remaining < 0.0 && autoWidth > 0.0) {
+				auto shrink = std::max(available - fixedWidth, 0.0f) / autoWidth;
+				for (size_t c = 0; c < columnCount; c++) {
+					if (m_columns[c].width == Width::Auto)
+						widths[c] = std::max(widths[c] * shrink, 2 * m_cellPadding + m_fontSize);
+				}
+				remaining = 0.0;
+			}
+			for (size_t c = 0; c < columnCount; c++) {
+				if (m_columns[c].width == Width::Proportional && weights > 0.0)
+					widths[c] = std::max(remaining, 0.0f) * m_columns[c].value / weights;
+			}
+
+			m_columnEdges.assign(1, m_range.x);
+			for (auto width : widths)
+				m_columnEdges.push_back(m_columnEdges.back() + width);
+		}
+
+		// assigns rows to pages top-down, a row that doesn't fit moves to the next page as a whole.
+		// a row that doesn't fit on a page of its own is cut between two lines into slices, one per page
+		void Paginate() {
+			m_placements.clear();
+			const auto lineHeight = m_cells.front().GetLineHeight();
+			float top = PDF_HEIGHT - m_startPosition.y;
+			size_t page = 0;
+			// a table starting further down the page leaves it for the next one like any other row
+			bool pageEmpty = top <= PDF_PADDING;
+
+			for (size_t row = 0; row < m_rows.size(); row++) {
+				// the part of the row's content placed on earlier pages
+				float offset = {};
+				while (true) {
+					auto height = m_rowHeights[row] - offset;
+					if (!pageEmpty && (top + height > PDF_BOTTOM)) {
+						page++;
+						top = PDF_PADDING;
+						for (size_t header = 0; header < std::min(m_headerRows, row); header++) {
+							m_placements.push_back(Placement{ header, page, top, 0.0, m_rowHeights[header], true });
+							top += m_rowHeights[header];
+						}
+						pageEmpty = true;
+					}
+
+					// as many whole lines as fit, the rest continues on the next page
+					auto lines = std::floor((PDF_BOTTOM - top - 2 * m_cellPadding) / lineHeight);
+					if ((top + height > PDF_BOTTOM) && (lines >= 1.0f)) {
+						auto slice = lines * lineHeight + 2 * m_cellPadding;
+						m_placements.push_back(Placement{ row, page, top, offset, slice, false });
+						offset += lines * lineHeight;
+						top += slice;
+						pageEmpty = false;
+						continue;
+					}
+
+					m_placements.push_back(Placement{ row, page, top, offset, height, false });
+					top += height;
+					pageEmpty = false;
+					break;
+				}
+			}
+		}
+
+		// records the grid of the placements [first, last) as a single stroked path
+		void AppendGrid(DisplayList& page, size_t first, size_t last) const {
+			const auto left = m_columnEdges.front(), right = m_columnEdges.back();
+			const auto top = m_placements[first].top;
+			const auto bottom = m_placements[last - 1].top + m_placements[last - 1].height;
+
+			Path grid(Paint::Stroke, m_gridColor, m_lineWidth);
+			grid.Reserve(2 * (last - first + 1 + m_columnEdges.size()));
+			for (auto i = first; i < last; i++)
+				grid.MoveTo({ left, m_placements[i].top }).LineTo({ right, m_placements[i].top });
+			grid.MoveTo({ left, bottom }).LineTo({ right, bottom });
+			for (auto x : m_columnEdges)
+				grid.MoveTo({ x, top }).LineTo({ x, bottom });
+
+			grid.Record(page);
+		}
+
+		Vector2 GetCellRange(size_t column) const {
+			return { m_columnEdges[column] + m_cellPadding, m_columnEdges[column + 1] - m_cellPadding };
+		}
+
+	public:
+		Vector2 Size() { return m_size; }
+		Vector2 Size() const { return m_size; }
+
+		Vector2 StartPosition() { return m_startPosition; }
+		Vector2 StartPosition() const { return m_startPosition; }
+
+	private:
+		struct Placement {
+			size_t row;
+			size_t page;
+			// depth of the row's top edge on its page
+			float top;
+			// for a row split over pages, the depth into its content where this slice starts
+			float offset;
+			float height;
+			// a header row repeated on a continuation page
+			bool repeated;
+		};
+
+	private:
+		// table content
+		std::vector<Column> m_columns;
+		std::vector<std::vector<std::wstring>> m_rows;
+		size_t m_headerRows = {};
+	private:
+		// table style
+		float m_fontSize;
+		float m_cellPadding = 4.0;
+		float m_lineWidth = 0.8;
+		Color3 m_gridColor = {};
+		Vector2 m_range;
+	private:
+		// layout results
+		std::vector<Text> m_cells;
+		std::vector<float> m_columnEdges;
+		std::vector<float> m_rowHeights;
+		std::vector<Placement> m_placements;
+		// recorded cells, one per placed row and column
+		std::vector<DisplayList> m_cellContents;
+	};
+
+	// Lays out its children once and places them with translations: the measure pass lays out every
+	// child in its own coordinates and caches its box and content, the arrange pass only computes
+	// offsets from the cached boxes. Moving a container never re-lays out its children.
+	class Container : Component<Container> {
+	public:
+		enum class Type {
+			// children keep their own positions
+			Group,
+			// children stacked top to bottom
+			Vertical,
+			// children lined up left to right
+			Horizontal
+		};
+
+	public:
+		Container(Type type, Vector2 position = {}, float spacing = 0.0)
+			: Component(position), m_type(type), m_spacing(spacing)
 		{
 			m_startPosition.y = PDF_HEIGHT - m_startPosition.y;
-			m_endPosition.y = PDF_HEIGHT - m_endPosition.y;
-			m_content = fmt::format("% Draw a line\r\n q {} {} {} RG {} {} m {} {} l 1.0 w S Q\r\n",
-				color.x, color.y, color.z, m_startPosition.x, m_startPosition.y, m_endPosition.x, m_endPosition.y);
-			++m_componentCount;
 		}
 
-	public:
-		Vector2 Size() { return m_size; }
-		Vector2 Size() const { return m_size; }
+	public:
+		template<class T>
+		Container& Append(T component) {
+			m_children.push_back(Child{ std::move(component) });
+			m_measured = false;
+			return *this;
+		}
+
+		Container& Append(Container component) {
+			m_children.push_back(Child{ std::make_shared<Container>(std::move(component)) });
+			m_measured = false;
+			return *this;
+		}
+
+		Container& SetPosition(Vector2 position) {
+			m_startPosition = { position.x, PDF_HEIGHT - position.y };
+			return *this;
+		}
+
+		Container& Translate(Vector2 offset) {
+			m_startPosition.x += offset.x;
+			m_startPosition.y -= offset.y;
+			return *this;
+		}
+
+	public:
+		void CalcLayout() {
+			if (m_measured) return;
+			Measure();
+			Arrange();
+			m_measured = true;
+		}
+
+		void Record(DisplayList& list) const {
+			auto translation = GetTranslation();
+			list.PushTranslation({ translation.x, -translation.y });
+			for (const auto& child : m_children) {
+				list.PushTranslation({ child.offset.x, -child.offset.y });
+				list.Append(child.content);
+				list.Pop();
+			}
+			list.Pop();
+		}
+
+		std::vector<DisplayList> GetContent() const {
+			std::vector<DisplayList> content(1);
+			Record(content.front());
+			return content;
+		}
+
+		size_t ChildCount() const {
+			return m_children.size();
+		}
+
+		// the cached page box of a child, valid after CalcLayout
+		BoundingBox ChildBounds(size_t i) const {
+			return m_children[i].box.Translated(m_children[i].offset).Translated(GetTranslation());
+		}
+
+	private:
+		void Measure() {
+			for (auto& child : m_children) {
+				std::visit([&child](auto& item) {
+					using T = std::decay_t<decltype(item)>;
+					if constexpr (std::is_same_v<T, std::shared_ptr<Container>>) {
+						item->CalcLayout();
+						child.content.Clear();
+						item->Record(child.content);
+						child.box = item->Bounds();
+					}
+					else {
+						// a container is placed on one page as a whole, Draw moves it to the next page
+						// when it doesn't fit, so its texts never break pages themselves
+						if constexpr (std::is_same_v<T, Text>)
+							item.SetAutoNextPage(false).CalcLayout();
+						child.content.Clear();
+						item.Record(child.content);
+						child.box = item.Bounds();
+					}
+				}, child.item);
+			}
+		}
+
+		void Arrange() {
+			float cursor = {};
+			m_box = {};
+			for (size_t i = 0; i < m_children.size(); i++) {
+				auto& child = m_children[i];
+				switch (m_type) {
+				case Type::Group: {
+					child.offset = {};
+					break;
+				}
+				case Type::Vertical: {
+					child.offset = { -child.box.Left(), cursor - child.box.Top() };
+					cursor += child.box.size.y + m_spacing;
+					break;
+				}
+				case Type::Horizontal: {
+					child.offset = { cursor - child.box.Left(), -child.box.Top() };
+					cursor += child.box.size.x + m_spacing;
+					break;
+				}
+				}
+
+				auto arranged = child.box.Translated(child.offset);
+				m_box = (i == 0) ? arranged : m_box.United(arranged);
+			}
+			m_size = m_box.size;
+		}
+
+		// the container origin in depth coordinates
+		Vector2 GetTranslation() const {
+			return { m_startPosition.x, PDF_HEIGHT - m_startPosition.y };
+		}
+
+	public:
+		Vector2 Size() { return m_size; }
+		Vector2 Size() const { return m_size; }
+
+		Vector2 StartPosition() { return m_startPosition; }
+		Vector2 StartPosition() const { return m_startPosition; }
+
+		// valid after CalcLayout
+		BoundingBox Bounds() const { return m_box.Translated(GetTranslation()); }
+
+	private:
+		struct Child {
+			std::variant<Text, Rect, Streak, Circle, Path, Batch, Image, std::shared_ptr<Container>> item;
+			// content laid out in the child's own coordinates
+			DisplayList content;
+			// box of the content before arrangement
+			BoundingBox box;
+			// translation assigned by the arrange pass
+			Vector2 offset;
+		};
+
+	private:
+		Type m_type;
+		float m_spacing;
+		std::vector<Child> m_children;
+		// union of the arranged children, relative to the container origin
+		BoundingBox m_box;
+		bool m_measured = false;
+	};
+
+	// The output of laying out one component, emitted in order by PDFTextTable
+	struct LayoutResult {
+		// one display list per page, every further page goes to a new page of the store
+		std::vector<DisplayList> pages;
+		// start a new page before the first one
+		bool nextPage = false;
+		float bottom = PDF_HEIGHT;
+		float drawPadding = {};
+	};
+
+	// Components whose layout only depends on their own geometry, so a batch of them can be laid out concurrently
+	using LayoutItem = std::variant<Text, Image, Table, Container>;
+
+	LayoutResult Layout(Text& component) {
+		component.CalcLayout();
+		return { component.GetContent(), false, component.GetBottom(), component.GetFontSize() + PDF_LINE_PADDING };
+	}
+
+	LayoutResult Layout(Image& component) {
+		return { component.GetContent(), false, component.RealDrawPosition().y, component.GetDrawPadding() };
+	}
+
+	LayoutResult Layout(Table& component) {
+		component.CalcLayout();
+		return { component.GetContent(), false, component.GetBottom(), PDF_SECTION_PADDING };
+	}
+
+	// a container that runs over the page bottom moves to the next page as a whole,
+	// decided from its cached box and applied as a translation
+	bool MoveToNextPage(Container& component) {
+		auto bounds = component.Bounds();
+		auto pageHeight = static_cast<float>(PDF_BOTTOM - PDF_PADDING);
+		auto nextPage = bounds.Bottom() > PDF_BOTTOM && bounds.Top() > PDF_PADDING && bounds.size.y <= pageHeight;
+		if (nextPage) {
+			component.Translate({ 0.0, PDF_PADDING - bounds.Top() });
+		}
+		return nextPage;
+	}
+
+	LayoutResult Layout(Container& component) {
+		component.CalcLayout();
+		auto nextPage = MoveToNextPage(component);
+		return { component.GetContent(), nextPage, PDF_HEIGHT - component.Bounds().Bottom(), PDF_SECTION_PADDING };
+	}
+
+	// Joins the pdfs of several renderer runs into one document without a pdf library. Objects are
+	// copied as they are with their references renumbered, streams byte for byte, and the page tree of
+	// every input becomes a kid of a new root, in the order they were added. Reads the classic xref
+	// table mutool create writes, a pdf with an xref stream or incremental updates is refused
+	class PdfMerger {
+	public:
+		PdfMerger() : m_out("%PDF-1.7\n%\xE2\xE3\xCF\xD3\n"), m_offsets(3) {}
+
+		// false if the pdf can't be read, nothing of it is added then
+		bool Add(std::string_view pdf) {
+			std::vector<XrefEntry> xref;
+			std::string_view trailer;
+			long long root, pages, count;
+			if (!ReadXref(pdf, xref, trailer) || !FindReference(trailer, "/Root", root) ||
+				!FindReference(ObjectBody(pdf, xref, root), "/Pages", pages) || !FindInteger(ObjectBody(pdf, xref, pages), "/Count", count)) {
+				return false;
+			}
+
+			// object n of the pdf becomes base + n, its catalog is left out for the new one
+			auto base = m_offsets.size() - 1;
+			std::string body;
+			std::vector<size_t> offsets(xref.size());
+			for (size_t number = 1; number < xref.size(); number++) {
+				if (!xref[number].used || number == static_cast<size_t>(root)) {
+					continue;
+				}
+				offsets[number] = m_out.size() + body.size();
+				if (!CopyObject(pdf, xref, number, base, body)) {
+					return false;
+				}
+				if (number == static_cast<size_t>(pages)) {
+					body.insert(body.find("<<", offsets[number] - m_out.size()) + 2, " /Parent 2 0 R");
+				}
+			}
+
+			m_out.append(body);
+			m_offsets.resize(base + xref.size());
+			for (size_t number = 1; number < xref.size(); number++) {
+				m_offsets[base + number] = offsets[number];
+			}
+			m_kids.push_back(base + pages);
+			m_pageCount += count;
+			return true;
+		}
+
+		// the merged document, the merger is spent afterwards
+		std::string Finish() {
+			m_offsets[1] = m_out.size();
+			m_out.append("1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+			m_offsets[2] = m_out.size();
+			m_out.append("2 0 obj\n<< /Type /Pages /Kids [");
+			for (auto kid : m_kids) {
+				fmt::format_to(std::back_inserter(m_out), " {} 0 R", kid);
+			}
+			fmt::format_to(std::back_inserter(m_out), " ] /Count {} >>\nendobj\n", m_pageCount);
+
+			auto xrefOffset = m_out.size();
+			fmt::format_to(std::back_inserter(m_out), "xref\n0 {}\n0000000000 65535 f\r\n", m_offsets.size());
+			for (size_t number = 1; number < m_offsets.size(); number++) {
+				fmt::format_to(std::back_inserter(m_out), "{:010} 00000 {}\r\n", m_offsets[number], m_offsets[number] ? 'n' : 'f');
+			}
+			fmt::format_to(std::back_inserter(m_out), "trailer\n<< /Size {} /Root 1 0 R >>\nstartxref\n{}\n%%EOF\n", m_offsets.size(), xrefOffset);
+			return std::move(m_out);
+		}
+
+	private:
+		struct XrefEntry {
+			size_t offset = 0;
+			bool used = false;
+		};
+
+		static bool IsWhite(char c) {
+			return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\0';
+		}
+
+		static bool IsDelimiter(char c) {
+			return std::strchr("()<>[]{}/%", c) != nullptr && c != '\0';
+		}
+
+		static size_t SkipWhite(std::string_view text, size_t pos) {
+			while (pos < text.size() && IsWhite(text[pos])) pos++;
+			return pos;
+		}
+
+		static size_t TokenEnd(std::string_view text, size_t pos) {
+			while (pos < text.size() && !IsWhite(text[pos]) && !IsDelimiter(text[pos])) pos++;
+			return pos;
+		}
+
+		// a plain unsigned integer at pos after white space, pos moves past it
+		static bool ReadInteger(std::string_view text, size_t& pos, long long& value) {
+			auto begin = SkipWhite(text, pos);
+			auto end = TokenEnd(text, begin);
+			auto result = std::from_chars(text.data() + begin, text.data() + end, value);
+			if (begin == end || result.ptr != text.data() + end || text[begin] == '-') {
+				return false;
+			}
+			pos = end;
+			return true;
+		}
+
+		// "n g R" at pos, pos moves past the R
+		static bool ReadReference(std::string_view text, size_t& pos, long long& number) {
+			auto p = pos;
+			long long generation;
+			if (!ReadInteger(text, p, number) || !ReadInteger(text, p, generation)) {
+				return false;
+			}
+			p = SkipWhite(text, p);
+			if (p >= text.size() || text[p] != 'R' || TokenEnd(text, p) != p + 1) {
+				return false;
+			}
+			pos = p + 1;
+			return true;
+		}
+
+		// the position right after key, a name not followed by more name characters
+		static size_t FindKey(std::string_view dict, std::string_view key) {
+			for (auto pos = dict.find(key); pos != std::string_view::npos; pos = dict.find(key, pos + 1)) {
+				if (TokenEnd(dict, pos + 1) == pos + key.size()) {
+					return pos + key.size();
+				}
+			}
+			return std::string_view::npos;
+		}
+
+		static bool FindReference(std::string_view dict, std::string_view key, long long& number) {
+			auto pos = FindKey(dict, key);
+			return pos != std::string_view::npos && ReadReference(dict, pos, number);
+		}
+
+		static bool FindInteger(std::string_view dict, std::string_view key, long long& value) {
+			auto pos = FindKey(dict, key);
+			return pos != std::string_view::npos && ReadInteger(dict, pos, value);
+		}
+
+		static bool ReadXref(std::string_view pdf, std::vector<XrefEntry>& xref, std::string_view& trailer) {
+			auto startxref = pdf.rfind("startxref");
+			long long offset;
+			size_t pos = startxref + 9;
+			if (startxref == std::string_view::npos || !ReadInteger(pdf, pos, offset) ||
+				static_cast<size_t>(offset) > pdf.size() || pdf.substr(static_cast<size_t>(offset), 4) != "xref") {
+				return false;
+			}
+
+			pos = static_cast<size_t>(offset) + 4;
+			while (true) {
+				pos = SkipWhite(pdf, pos);
+				if (pdf.substr(pos, 7) == "trailer") {
+					break;
+				}
+				long long first, count;
+				if (!ReadInteger(pdf, pos, first) || !ReadInteger(pdf, pos, count)) {
+					return false;
+				}
+				xref.resize(std::max(xref.size(), static_cast<size_t>(first + count)));
+				for (auto number = first; number < first + count; number++) {
+					long long objectOffset, generation;
+					if (!ReadInteger(pdf, pos, objectOffset) || !ReadInteger(pdf, pos, generation)) {
+						return false;
+					}
+					pos = SkipWhite(pdf, pos);
+					xref[number] = { static_cast<size_t>(objectOffset), pdf.substr(pos, 1) == "n" };
+					pos++;
+				}
+			}
+			// an encrypted pdf keys its objects by their numbers, which the merge changes
+			trailer = pdf.substr(pos, startxref - pos);
+			return FindKey(trailer, "/Prev") == std::string_view::npos && FindKey(trailer, "/Encrypt") == std::string_view::npos;
+		}
+
+		// where the body of object number starts, after its "n g obj", npos if it isn't there
+		static size_t ObjectStart(std::string_view pdf, const std::vector<XrefEntry>& xref, long long number) {
+			if (number <= 0 || static_cast<size_t>(number) >= xref.size() || !xref[number].used) {
+				return std::string_view::npos;
+			}
+			auto pos = xref[number].offset;
+			long long found, generation;
+			if (!ReadInteger(pdf, pos, found) || found != number || !ReadInteger(pdf, pos, generation)) {
+				return std::string_view::npos;
+			}
+			pos = SkipWhite(pdf, pos);
+			return (pdf.substr(pos, 3) == "obj") ? pos + 3 : std::string_view::npos;
+		}
+
+		// the text of an object up to its end, enough to look up the keys of a dictionary
+		static std::string_view ObjectBody(std::string_view pdf, const std::vector<XrefEntry>& xref, long long number) {
+			auto start = ObjectStart(pdf, xref, number);
+			if (start == std::string_view::npos) {
+				return {};
+			}
+			auto end = pdf.find("endobj", start);
+			return pdf.substr(start, (end == std::string_view::npos) ? 0 : end - start);
+		}
+
+		// copies the tokens from pos on with every reference moved by base, up to the keyword stream or
+		// endobj, and returns where that keyword starts, npos if there is none
+		static size_t CopyTokens(std::string_view pdf, size_t pos, size_t base, std::string& out) {
+			while (pos < pdf.size()) {
+				auto c = pdf[pos];
+				auto begin = pos;
+				if (c == '(') {
+					// literal strings nest and escape their parentheses
+					int depth = 0;
+					for (; pos < pdf.size(); pos++) {
+						if (pdf[pos] == '\\') pos++;
+						else if (pdf[pos] == '(') depth++;
+						else if (pdf[pos] == ')' && --depth == 0) break;
+					}
+					pos++;
+				}
+				else if (pdf.substr(pos, 2) == "<<" || pdf.substr(pos, 2) == ">>") {
+					pos += 2;
+				}
+				else if (c == '<') {
+					pos = pdf.find('>', pos);
+					pos = (pos == std::string_view::npos) ? pdf.size() : pos + 1;
+				}
+				else if (c == '%') {
+					pos = pdf.find_first_of("\r\n", pos);
+					pos = (pos == std::string_view::npos) ? pdf.size() : pos;
+				}
+				else if (c == '/') {
+					pos = TokenEnd(pdf, pos + 1);
+				}
+				else if (IsWhite(c) || IsDelimiter(c)) {
+					pos++;
+				}
+				else {
+					pos = TokenEnd(pdf, pos);
+					auto token = pdf.substr(begin, pos - begin);
+					if (token == "stream" || token == "endobj") {
+						return begin;
+					}
+					long long number;
+					auto end = begin;
+					if (c >= '0' && c <= '9' && ReadReference(pdf, end, number)) {
+						fmt::format_to(std::back_inserter(out), "{} 0 R", number + base);
+						pos = end;
+						continue;
+					}
+				}
+				out.append(pdf.substr(begin, pos - begin));
+			}
+			return std::string_view::npos;
+		}
+
+		static bool CopyObject(std::string_view pdf, const std::vector<XrefEntry>& xref, size_t number, size_t base, std::string& out) {
+			auto start = ObjectStart(pdf, xref, number);
+			if (start == std::string_view::npos) {
+				return false;
+			}
+			fmt::format_to(std::back_inserter(out), "{} 0 obj", number + base);
+			auto keyword = CopyTokens(pdf, start, base, out);
+			if (keyword == std::string_view::npos) {
+				return false;
+			}
+			if (pdf.substr(keyword, 6) == "endobj") {
+				out.append("endobj\n");
+				return true;
+			}
+
+			// the data of a stream is copied as it is, its length may be an object of its own
+			auto dict = pdf.substr(start, keyword - start);
+			long long length, lengthObject;
+			if (FindReference(dict, "/Length", lengthObject)) {
+				auto pos = ObjectStart(pdf, xref, lengthObject);
+				if (pos == std::string_view::npos || !ReadInteger(pdf, pos, length)) {
+					return false;
+				}
+			}
+			else if (!FindInteger(dict, "/Length", length)) {
+				return false;
+			}
+			auto data = keyword + 6;
+			data += (pdf.substr(data, 2) == "\r\n") ? 2 : 1;
+			auto end = SkipWhite(pdf, data + static_cast<size_t>(length));
+			if (data + static_cast<size_t>(length) > pdf.size() || pdf.substr(end, 9) != "endstream") {
+				return false;
+			}
+			out.append("stream\n").append(pdf.substr(data, static_cast<size_t>(length))).append("\nendstream\nendobj\n");
+			return true;
+		}
+
+	private:
+		std::string m_out;
+		// where every object of the merged document starts, 0 for the free ones
+		std::vector<size_t> m_offsets;
+		std::vector<size_t> m_kids;
+		long long m_pageCount = 0;
+	};
+
+	// the mutool compatible program that turns the page scripts into a pdf
+#ifdef _WIN32
+	const char* const PDF_RENDERER = "mutool.exe";
+#else
+	const char* const PDF_RENDERER = "mutool";
+#endif
+
+	// page scripts above this many bytes move from memory to the document's spill file
+	const size_t PAGE_STORE_BUDGET = 64 << 20;
+
+	unsigned long CurrentProcessId() {
+#ifdef _WIN32
+		return GetCurrentProcessId();
+#else
+		return static_cast<unsigned long>(getpid());
+#endif
+	}
+
+	// A path in the temp directory that no other document or process picks
+	std::filesystem::path UniqueTempPath(std::string_view name) {
+		static std::atomic<size_t> counter;
+		return std::filesystem::temp_directory_path() / fmt::format("pdf{}-{}-{}", CurrentProcessId(), counter++, name);
+	}
+
+	// The page scripts of one document, kept in memory until the pdf is generated. Once they take
+	// more than the budget, the finished pages move to a single temp file, written on the I/O thread
+	class PageStore {
+	public:
+		explicit PageStore(size_t budget = PAGE_STORE_BUDGET) : m_budget(budget) {}
+		~PageStore() {
+			if (m_spill) {
+				m_spill.reset();
+				lxd::RemoveFile(m_spillPath.c_str());
+			}
+		}
+		PageStore(const PageStore&) = delete;
+		PageStore& operator=(const PageStore&) = delete;
+
+		size_t Count() const { return m_pages.size(); }
+		size_t SpilledCount() const { return m_spilled; }
+
+		// starts the next page, appends go to it from now on
+		void NewPage() {
+			m_pages.emplace_back();
+		}
+
+		void Append(std::string_view script) {
+			m_pages.back().script.append(script);
+			m_memory += script.size();
+			if (m_memory > m_budget) {
+				Spill();
+			}
+		}
+
+		// the script of page i, read back from the spill file if it was moved there
+		std::string Read(size_t i) {
+			auto& page = m_pages[i];
+			if (page.offset < 0) {
+				return page.script;
+			}
+			std::string script(page.size, '\0');
+			m_spill->seek(page.offset, lxd::FileBegin);
+			m_spill->read(script.data(), static_cast<unsigned long>(page.size));
+			m_spill->seek(0, lxd::FileEnd);
+			return script;
+		}
+
+	private:
+		struct Page {
+			std::string script;
+			// where the page starts in the spill file, -1 while it is in memory
+			long long offset = -1;
+			size_t size = 0;
+		};
 
-		int32_t Count() { return m_componentCount; }
-		int32_t Count() const { return m_componentCount; }
+		// the page being written stays in memory, later appends would have to patch the file
+		void Spill() {
+			if (!m_spill) {
+				m_spillPath = UniqueTempPath("pages.tmp").wstring();
+				m_spill = std::make_unique<lxd::File>(m_spillPath, lxd::ReadWrite | lxd::Truncate);
+				m_spill->setWriteBehind(&GetWriteBehind());
+			}
+			for (; m_spilled + 1 < m_pages.size(); m_spilled++) {
+				auto& page = m_pages[m_spilled];
+				page.offset = m_spill->size();
+				page.size = page.script.size();
+				m_spill->write(page.script.data(), page.size);
+				m_memory -= page.size;
+				std::string().swap(page.script);
+			}
+		}
 
-		std::string_view Content() { return m_content; }
-		std::string_view Content() const { return m_content; }
+	private:
+		std::vector<Page> m_pages;
+		size_t m_budget;
+		size_t m_memory = 0;
+		size_t m_spilled = 0;
+		std::wstring m_spillPath;
+		std::unique_ptr<lxd::File> m_spill;
+	};
 
-		Vector2 StartPosition() { return m_startPosition; }
-		Vector2 StartPosition() const { return m_startPosition; }
+	// A page on its way from layout into the page store. The display list and its script live in an arena
+	// of the page's own, so pages further down the pipeline don't hold on to the page being laid out
+	struct PageBuffer {
+		// drop the list's storage before the arena takes it back, a move assignment would let
+		// the byte pool keep its buffer when the moved-from string is short
+		void Reset() {
+			std::destroy_at(&list);
+			std::destroy_at(&script);
+			arena.release();
+			std::construct_at(&list, &arena);
+			std::construct_at(&script, &arena);
+			newPage = false;
+		}
 
-	private:
-		Vector2 m_endPosition;
+		std::pmr::monotonic_buffer_resource arena{ 64 * 1024 };
+		DisplayList list{ &arena };
+		std::pmr::string script{ &arena };
+		// starts a page of the store, otherwise the script goes on with the last one
+		bool newPage = false;
+		int precision = PDF_OPERAND_PRECISION;
 	};
 
-	class Rect : Component<Rect> {
-	public:
-		enum class Type {
-			Block,
-			Outline,
-			BackGround
-		};
+	// What a pipeline stage did with its time: working, waiting for the stage before it and waiting for
+	// room in the ring to the stage after it
+	struct StageStats {
+		const char* name = "";
+		size_t pages = 0;
+		std::chrono::microseconds busy{};
+		std::chrono::microseconds starved{};
+		std::chrono::microseconds blocked{};
+
+		double Utilisation() const {
+			auto total = (busy + starved + blocked).count();
+			return total ? static_cast<double>(busy.count()) / total : 0.0;
+		}
+	};
 
+	// Serializes and stores the pages of one table on threads of their own while the table lays out the
+	// next ones: layout -> serialize -> store, connected by bounded single producer rings. A full ring makes
+	// the stage in front of it wait, so no more than depth pages are in flight between two stages. Stored
+	// pages go back to layout for reuse. There is no compression stage, the renderer compresses the pdf
+	class PagePipeline {
 	public:
-		Rect(Vector2 startPosition, Vector2 size, Vector3 color, Rect::Type type)
-			: Component(startPosition, size), m_type(type)
+		enum Stage { Layout, Serialize, Store, Stages };
+
+		PagePipeline(PageStore& store, size_t depth)
+			: m_store(store), m_toSerialize(depth), m_toStore(depth), m_recycled(2 * depth + 2)
 		{
-			m_startPosition.y = PDF_HEIGHT - m_startPosition.y;
+			m_last = std::chrono::steady_clock::now();
+			m_serializer = std::thread([this]() { SerializeLoop(); });
+			m_storer = std::thread([this]() { StoreLoop(); });
+		}
 
-			switch (type) {
-			case Type::Block: {
-				m_content = fmt::format("% Draw a rect\r\nq {} {} {} rg {} {} {} {} re f h B Q\r\n",
-					color.x, color.y, color.z, m_startPosition.x, m_startPosition.y - m_size.y, m_size.x, m_size.y);
-				break;
-			}
-			case Type::Outline: {
-				m_content = fmt::format("% Draw a Outline rect\r\nq 0.8 w {} {} {} RG {} {} {} {} re h s Q\r\n",
-					color.x, color.y, color.z, m_startPosition.x, m_startPosition.y - m_size.y, m_size.x, m_size.y);
-				break;
+		// stores the pages submitted so far before it returns
+		~PagePipeline() {
+			m_toSerialize.push(nullptr);
+			m_serializer.join();
+			m_storer.join();
+			PageBuffer* page = nullptr;
+			while (m_recycled.tryPop(page)) {
+				delete page;
 			}
-			case Type::BackGround: {
-				m_content = fmt::format("% Draw a rect\r\nq {} {} {} rg {} {} {} {} re f h B Q\r\n",
-					color.x, color.y, color.z, m_startPosition.x, m_startPosition.y - m_size.y, m_size.x, m_size.y);
-				break;
+		}
+
+		PagePipeline(const PagePipeline&) = delete;
+		PagePipeline& operator=(const PagePipeline&) = delete;
+
+		// hands a laid out page on, waits while the serializer is a full ring behind
+		void Submit(std::unique_ptr<PageBuffer> page) {
+			auto now = std::chrono::steady_clock::now();
+			Add(m_counters[Layout].busy, now - m_last);
+			m_toSerialize.push(page.release());
+			m_last = std::chrono::steady_clock::now();
+			Add(m_counters[Layout].blocked, m_last - now);
+			m_counters[Layout].pages++;
+			m_submitted++;
+		}
+
+		// an empty page, one the store is done with when there is one
+		std::unique_ptr<PageBuffer> Acquire() {
+			PageBuffer* page = nullptr;
+			if (m_recycled.tryPop(page)) {
+				return std::unique_ptr<PageBuffer>(page);
 			}
-			default: {
-				break;
+			return std::make_unique<PageBuffer>();
+		}
+
+		// waits until every submitted page is in the store, then adds what the serializer culled to stats
+		void Drain(CullStats& stats) {
+			auto now = std::chrono::steady_clock::now();
+			for (auto stored = m_stored.load(std::memory_order_acquire); stored != m_submitted; stored = m_stored.load(std::memory_order_acquire)) {
+				m_stored.wait(stored, std::memory_order_acquire);
 			}
+			m_last = std::chrono::steady_clock::now();
+			Add(m_counters[Layout].blocked, m_last - now);
+			stats.components += std::exchange(m_cullStats.components, 0);
+			stats.commands += std::exchange(m_cullStats.commands, 0);
+			stats.textRuns += std::exchange(m_cullStats.textRuns, 0);
+		}
+
+		// may be read at any time, from any thread
+		std::array<StageStats, Stages> Stats() const {
+			static const char* const names[Stages] = { "layout", "serialize", "store" };
+			std::array<StageStats, Stages> stats;
+			for (size_t i = 0; i < Stages; i++) {
+				stats[i].name = names[i];
+				stats[i].pages = m_counters[i].pages.load();
+				stats[i].busy = std::chrono::microseconds(m_counters[i].busy.load());
+				stats[i].starved = std::chrono::microseconds(m_counters[i].starved.load());
+				stats[i].blocked = std::chrono::microseconds(m_counters[i].blocked.load());
 			}
+			return stats;
+		}
 
-			++m_componentCount;
+	private:
+		struct Counters {
+			std::atomic<size_t> pages{};
+			std::atomic<long long> busy{};
+			std::atomic<long long> starved{};
+			std::atomic<long long> blocked{};
+		};
+
+		static void Add(std::atomic<long long>& counter, std::chrono::steady_clock::duration time) {
+			counter.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(time).count(), std::memory_order_relaxed);
 		}
 
-	public:
-		Vector2 Size() { return m_size; }
-		Vector2 Size() const { return m_size; }
+		// a null page ends the stage and is passed on, so the next one ends after it
+		template <class Work>
+		void RunStage(Stage stage, lxd::SpscRing<PageBuffer*>& input, Work&& work) {
+			auto& counters = m_counters[stage];
+			while (true) {
+				auto waiting = std::chrono::steady_clock::now();
+				auto page = input.pop();
+				auto begin = std::chrono::steady_clock::now();
+				Add(counters.starved, begin - waiting);
+				if (!page) {
+					work(page);
+					return;
+				}
+				auto end = work(page);
+				Add(counters.busy, end - begin);
+				Add(counters.blocked, std::chrono::steady_clock::now() - end);
+				counters.pages++;
+			}
+		}
 
-		int32_t Count() { return m_componentCount; }
-		int32_t Count() const { return m_componentCount; }
+		void SerializeLoop() {
+			RunStage(Serialize, m_toSerialize, [this](PageBuffer* page) {
+				if (page) {
+					ScriptWriter::Write(page->list, page->script, page->precision, PDF_PAGE_BOX, m_cullStats);
+				}
+				auto end = std::chrono::steady_clock::now();
+				m_toStore.push(page);
+				return end;
+			});
+		}
 
-		std::string_view Content() { return m_content; }
-		std::string_view Content() const { return m_content; }
+		void StoreLoop() {
+			RunStage(Store, m_toStore, [this](PageBuffer* page) {
+				auto end = std::chrono::steady_clock::now();
+				if (!page) {
+					return end;
+				}
+				if (page->newPage) {
+					m_store.NewPage();
+				}
+				m_store.Append(page->script);
+				page->Reset();
+				end = std::chrono::steady_clock::now();
+				// layout allocates a new page when it doesn't take them back fast enough
+				if (!m_recycled.tryPush(page)) {
+					delete page;
+				}
+				m_stored.fetch_add(1, std::memory_order_release);
+				m_stored.notify_one();
+				return end;
+			});
+		}
 
-		Vector2 StartPosition() { return m_startPosition; }
-		Vector2 StartPosition() const { return m_startPosition; }
-	public:
-		Type m_type;
+	private:
+		PageStore& m_store;
+		lxd::SpscRing<PageBuffer*> m_toSerialize;
+		lxd::SpscRing<PageBuffer*> m_toStore;
+		lxd::SpscRing<PageBuffer*> m_recycled;
+		// written by the serializer only, read by layout after a drain
+		CullStats m_cullStats;
+		Counters m_counters[Stages];
+		// layout's own, when it last returned to laying out
+		std::chrono::steady_clock::time_point m_last;
+		size_t m_submitted = 0;
+		std::atomic<size_t> m_stored{};
+		std::thread m_serializer;
+		std::thread m_storer;
 	};
 
-	class Circle : Component<Circle> {
-	public:
-		Circle(Vector2 startPosition, float radius, Vector3 color)
-			: m_radius(radius), m_color(color)
-		{
-			m_startPosition = startPosition;
-			m_startPosition.y = PDF_HEIGHT - m_startPosition.y;
+	// scripts of cached pages kept in memory, and on disk when the cache has a directory
+	const size_t PAGE_CACHE_BUDGET = 64 << 20;
+	const size_t PAGE_CACHE_DISK_BUDGET = 1ull << 30;
+	// goes up whenever the script or file format changes, so pages cached on disk by older builds are left alone
+	const uint32_t PAGE_CACHE_VERSION = 2;
 
-			auto& pos = m_startPosition;
-			auto ofs = m_radius * 0.553;
-			m_content = fmt::format(
-				"% Draw a circle\nq 0.01 w\n{} {} {} rg\n{} {} m\n{} {} {} {} {} {} c \n{} {} l\n{} {} {} {} {} {} c \n{} {} l\n{} {} {} {} {} {} c \n{} {} l\n{} {} {} {} {} {} c \nh f\nQ\n",
-				color.x, color.y, color.z,
-				pos.x, pos.y,
-				pos.x, pos.y + ofs, pos.x + m_radius - ofs, pos.y + m_radius, pos.x + m_radius, pos.y + m_radius,
-				pos.x + m_radius, pos.y + m_radius,
-				pos.x + m_radius + ofs, pos.y + m_radius, pos.x + 2 * m_radius, pos.y + ofs, pos.x + 2 * m_radius, pos.y,
-				pos.x + 2 * m_radius, pos.y,
-				pos.x + 2 * m_radius, pos.y - ofs, pos.x + m_radius + ofs, pos.y - m_radius, pos.x + m_radius, pos.y - m_radius,
-				pos.x + m_radius, pos.y - m_radius,
-				pos.x + m_radius - ofs, pos.y - m_radius, pos.x, pos.y - ofs, pos.x, pos.y);
+	// Everything a page is drawn from, one input after another. Strings go in with their length, so
+	// different inputs never run together into the same key
+	class PageKey {
+	public:
+		PageKey& Add(std::string_view bytes) {
+			Add(bytes.size());
+			m_bytes.append(bytes);
+			return *this;
 		}
 
-	public:
-		Vector2 Size() { return m_size; }
-		Vector2 Size() const { return m_size; }
+		PageKey& Add(std::wstring_view text) {
+			return Add(std::string_view(reinterpret_cast<const char*>(text.data()), text.size() * sizeof(wchar_t)));
+		}
 
-		int32_t Count() { return m_componentCount; }
-		int32_t Count() const { return m_componentCount; }
+		PageKey& Add(const char* text) {
+			return Add(std::string_view(text));
+		}
 
-		std::string_view Content() { return m_content; }
-		std::string_view Content() const { return m_content; }
+		template <class T> requires std::is_arithmetic_v<T> || std::is_enum_v<T>
+		PageKey& Add(T value) {
+			m_bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+			return *this;
+		}
 
-		Vector2 StartPosition() { return m_startPosition; }
-		Vector2 StartPosition() const { return m_startPosition; }
-	public:
-		float m_radius = {};
-		Vector3 m_color = {};
-	};
+		// the image by path, size and modification time, an image changed in place makes a new key
+		PageKey& AddImage(const std::string& path) {
+			std::error_code error;
+			auto size = std::filesystem::file_size(path, error);
+			auto time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+			return Add(path).Add(error ? 0 : size).Add(error ? 0 : time);
+		}
 
-	// TODO: A total overhaul for lazy evaluation
-	class Image : Component<Image> {
-	public:
-		enum class Direction { Upwards, Downwards };
+		const std::string& Bytes() const {
+			return m_bytes;
+		}
 
-	public:
-		Image(std::string_view m_imageId, Vector2 startPosition, Vector2 size, Direction drawDirection = Direction::Upwards)
-			: Component(startPosition, size), m_imageId(m_imageId), scaling(1.0), direction(drawDirection)
-		{
-			m_startPosition.y = PDF_HEIGHT - m_startPosition.y;
-			auto verticalStartPos = (direction == Direction::Upwards) ? m_startPosition.y : m_startPosition.y - m_size.y;
-			realDrawCoord = Vector2{ m_startPosition.x, verticalStartPos };
-			m_content = fmt::format("% Draw an image\r\nq {} 0 0 {} {} {} cm {} Do Q\r\n", m_size.x, m_size.y, realDrawCoord.x, realDrawCoord.y, m_imageId);
-			++m_componentCount;
-			++m_index;
+		// names the page on disk, the bytes tell pages with the same hash apart
+		uint64_t Hash() const {
+			return Fnv1a(m_bytes);
 		}
 
-		Image(std::string_view path, Vector2 startPosition, float imageHeight, Direction drawDirection = Direction::Upwards)
-			: Component(startPosition), scaling(1.0), direction(drawDirection)
-		{
-			m_startPosition.y = PDF_HEIGHT - m_startPosition.y;
+	private:
+		std::string m_bytes;
+	};
 
-			// config size
-			int32_t w = {}, h = {}, comp = {};
-			stbi_info(path.data(), &w, &h, &comp);
-			scaling = imageHeight / h;
-			auto width = w * scaling, height = imageHeight;
-			m_size = Vector2{ width , height };
+	// The scripts of the pages one PDFTextTable::DrawPage call produced, and the state of the table after it
+	struct CachedPages {
+		std::vector<std::string> scripts;
+		size_t components = 0;
+		size_t images = 0;
+		size_t bottom = 0;
+		float drawPadding = 0.0f;
+		// what the draw left out, counted again on every hit
+		CullStats culled;
+
+		size_t Size() const {
+			return std::accumulate(scripts.begin(), scripts.end(), sizeof(CachedPages),
+				[](size_t size, const std::string& script) { return size + script.size(); });
+		}
+	};
 
-			auto verticalStartPos = (direction == Direction::Upwards) ? m_startPosition.y : m_startPosition.y - m_size.y;
-			realDrawCoord = Vector2{ m_startPosition.x, verticalStartPos };
+	// Pages by their PageKey, shared by every table. The least recently used go once the memory budget is
+	// exceeded; with a directory set they are also written there and found again by later processes, under
+	// a budget of their own with the least recently used files removed first
+	class PageCache {
+	public:
+		struct Stats {
+			size_t hits = 0;
+			size_t diskHits = 0;
+			size_t misses = 0;
+		};
 
-			if (std::filesystem::exists(path.data())) {
-				auto imageData = fmt::format("%%Image I{} {}\r\n", m_index, path);
-				m_content.append(imageData);
+		explicit PageCache(size_t budget = PAGE_CACHE_BUDGET) : m_budget(budget) {}
+
+		// an empty directory keeps the cache in memory only
+		void SetDirectory(const std::filesystem::path& directory, size_t budget = PAGE_CACHE_DISK_BUDGET) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_directory = directory;
+			m_diskBudget = budget;
+			m_files.clear();
+			m_fileIndex.clear();
+			m_diskSize = 0;
+			if (directory.empty()) {
+				return;
+			}
+			std::error_code error;
+			std::filesystem::create_directories(directory, error);
+			// the files left by earlier runs, least recently used first
+			std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> files;
+			for (auto& entry : std::filesystem::directory_iterator(directory, error)) {
+				if (entry.path().extension() == ".page") {
+					files.emplace_back(entry.last_write_time(error), entry.path());
+				}
+			}
+			std::sort(files.begin(), files.end());
+			for (auto& [time, path] : files) {
+				auto size = std::filesystem::file_size(path, error);
+				Touch(path, error ? 0 : size);
 			}
+			auto trimmed = TrimDisk();
+			lock.unlock();
+			Remove(trimmed);
+		}
 
-			m_imageId = fmt::format("/I{}", m_index);
+		// the lock is only held for the lookups and the bookkeeping, a file is read without it
+		std::shared_ptr<const CachedPages> Find(const PageKey& key) {
+			std::filesystem::path directory;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				auto it = m_entries.find(key.Bytes());
+				if (it != m_entries.end()) {
+					m_order.splice(m_order.end(), m_order, it->second.order);
+					m_stats.hits++;
+					return it->second.pages;
+				}
+				directory = m_directory;
+			}
 
-			m_content += fmt::format("% Draw an image\r\nq {} 0 0 {} {} {} cm {} Do Q\r\n", m_size.x, m_size.y, realDrawCoord.x, realDrawCoord.y, m_imageId);
-			++m_componentCount;
-			++m_index;
-		}
+			auto path = directory.empty() ? std::filesystem::path() : FilePath(directory, key);
+			size_t size = 0;
+			auto pages = directory.empty() ? nullptr : ReadDisk(path, key, size);
 
-	public:
-		Image& SetAlignment(ALIGNMENT alignment) {
-			switch (alignment) {
-			case ALIGNMENT::DEFAULT: {
-				m_content = fmt::format("% Draw an image\r\nq {} 0 0 {} {} {} cm {} Do Q\r\n",
-					m_size.x, m_size.y, realDrawCoord.x, realDrawCoord.y, m_imageId);
-				break;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!pages) {
+				m_stats.misses++;
+				return nullptr;
 			}
-			case ALIGNMENT::LEFT: {
-				realDrawCoord.x = PDF_PADDING;
-				m_content = fmt::format("% Draw an image\r\nq {} 0 0 {} {} {} cm {} Do Q\r\n",
-					m_size.x, m_size.y, realDrawCoord.x, realDrawCoord.y, m_imageId);
-				break;
+			m_stats.diskHits++;
+			Remember(key.Bytes(), pages);
+			if (m_directory == directory) {
+				Touch(path, size);
 			}
-			case ALIGNMENT::CENTER: {
-				realDrawCoord.x = PDF_WIDTH / 2.0 - m_size.x / 2.0;
-				m_content = fmt::format("% Draw an image\r\nq {} 0 0 {} {} {} cm {} Do Q\r\n",
-					m_size.x, m_size.y, realDrawCoord.x, realDrawCoord.y, m_imageId);
-				break;
+			return pages;
+		}
+
+		// the pages are written, renamed and the directory trimmed without the lock, the other threads only
+		// wait for the bookkeeping
+		void Insert(const PageKey& key, CachedPages pages) {
+			auto shared = std::make_shared<const CachedPages>(std::move(pages));
+			std::filesystem::path directory;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				Remember(key.Bytes(), shared);
+				directory = m_directory;
 			}
-			case ALIGNMENT::RIGHT: {
-				realDrawCoord.x = PDF_WIDTH - PDF_PADDING - m_size.x;
-				m_content = fmt::format("% Draw an image\r\nq {} 0 0 {} {} {} cm {} Do Q\r\n",
-					m_size.x, m_size.y, realDrawCoord.x, realDrawCoord.y, m_imageId);
-				break;
+			if (directory.empty()) {
+				return;
+			}
+
+			auto path = FilePath(directory, key);
+			auto size = WriteDisk(path, key, *shared);
+			if (size == 0) {
+				return;
 			}
+			std::vector<std::string> trimmed;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				// the directory was changed meanwhile, the file isn't counted against the new one
+				if (m_directory != directory) {
+					return;
+				}
+				Touch(path, size);
+				trimmed = TrimDisk();
 			}
+			Remove(trimmed);
+		}
 
-			return *this;
+		Stats GetStats() const {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_stats;
 		}
 
-		Image& AttachCaption(std::wstring_view caption, float fontSize = 12.0, ALIGNMENT alignment = ALIGNMENT::CENTER) {
-			float depth;
+	private:
+		struct Entry {
+			std::shared_ptr<const CachedPages> pages;
+			// the scripts and the key
+			size_t size = 0;
+			std::list<const std::string*>::iterator order;
+		};
 
-			if (direction == Direction::Downwards) {
-				depth = realDrawCoord.y - fontSize * (1.0 + captionSpacing);
-				depth = PDF_HEIGHT - depth;
+		struct File {
+			std::string path;
+			size_t size = 0;
+		};
+
+		void Remember(const std::string& key, std::shared_ptr<const CachedPages> pages) {
+			auto it = m_entries.find(key);
+			if (it != m_entries.end()) {
+				m_size -= it->second.size;
+				m_order.erase(it->second.order);
+				m_entries.erase(it);
 			}
-			else {
-				depth = realDrawCoord.y + m_size.y + fontSize * captionSpacing;
-				depth = PDF_HEIGHT - depth;
+			auto size = pages->Size() + key.size();
+			it = m_entries.emplace(key, Entry{ std::move(pages), size }).first;
+			// the keys of the map stay where they are, the order points at them instead of copying them
+			it->second.order = m_order.insert(m_order.end(), &it->first);
+			m_size += size;
+			while (m_size > m_budget && m_order.size() > 1) {
+				auto oldest = m_entries.find(*m_order.front());
+				m_size -= oldest->second.size;
+				m_order.pop_front();
+				m_entries.erase(oldest);
 			}
+		}
 
-			m_content.append("% Draw image caption\r\n");
-			m_caption.SetFontSize(fontSize).Append(caption)
-				.SetAlignment(depth, alignment, { realDrawCoord.x, realDrawCoord.x + m_size.x })
-				.CalcLayout();
-			m_content.append(m_caption.GetContent().front());
+		static std::filesystem::path FilePath(const std::filesystem::path& directory, const PageKey& key) {
+			return directory / fmt::format("{:016x}.page", key.Hash());
+		}
 
-			return *this;
+		// version, key, table state, then every script with its size. The bytes written, 0 if it failed
+		static size_t WriteDisk(const std::filesystem::path& path, const PageKey& key, const CachedPages& pages) {
+			std::string data;
+			auto put = [&data](auto value) { data.append(reinterpret_cast<const char*>(&value), sizeof(value)); };
+			put(PAGE_CACHE_VERSION);
+			put(static_cast<uint64_t>(key.Bytes().size()));
+			data.append(key.Bytes());
+			put(static_cast<uint64_t>(pages.components));
+			put(static_cast<uint64_t>(pages.images));
+			put(static_cast<uint64_t>(pages.bottom));
+			put(pages.drawPadding);
+			put(pages.culled);
+			put(static_cast<uint64_t>(pages.scripts.size()));
+			for (auto& script : pages.scripts) {
+				put(static_cast<uint64_t>(script.size()));
+				data.append(script);
+			}
+
+			// written next to it and renamed, another process or thread never reads half a page. The temp
+			// name is unique per thread too, two threads may write the same page at once
+			static std::atomic<size_t> counter;
+			auto temp = path;
+			temp += fmt::format(".{}-{}.tmp", CurrentProcessId(), counter++);
+			std::error_code error;
+			if (!lxd::WriteFile(temp.wstring().c_str(), data.data(), data.size())) {
+				return 0;
+			}
+			std::filesystem::rename(temp, path, error);
+			if (error) {
+				std::filesystem::remove(temp, error);
+				return 0;
+			}
+			return data.size();
 		}
 
-		Image& SetCaptionSpacing(float spacing) {
-			captionSpacing = spacing;
-			return *this;
+		// size is set to the bytes of the file when the pages were read
+		static std::shared_ptr<const CachedPages> ReadDisk(const std::filesystem::path& path, const PageKey& key, size_t& size) {
+			auto data = lxd::ReadFile(path.wstring().c_str());
+			std::string_view rest(data);
+			auto get = [&rest](auto& value) {
+				if (rest.size() < sizeof(value)) {
+					return false;
+				}
+				std::memcpy(&value, rest.data(), sizeof(value));
+				rest.remove_prefix(sizeof(value));
+				return true;
+			};
+			auto getBytes = [&rest, &get](std::string& bytes) {
+				uint64_t size = 0;
+				if (!get(size) || rest.size() < size) {
+					return false;
+				}
+				bytes.assign(rest.substr(0, size));
+				rest.remove_prefix(size);
+				return true;
+			};
+
+			uint32_t version = 0;
+			std::string storedKey;
+			uint64_t components = 0, images = 0, bottom = 0, count = 0;
+			auto pages = std::make_shared<CachedPages>();
+			if (!get(version) || version != PAGE_CACHE_VERSION || !getBytes(storedKey) || storedKey != key.Bytes() ||
+				!get(components) || !get(images) || !get(bottom) || !get(pages->drawPadding) || !get(pages->culled) || !get(count)) {
+				return nullptr;
+			}
+			pages->scripts.resize(count);
+			for (auto& script : pages->scripts) {
+				if (!getBytes(script)) {
+					return nullptr;
+				}
+			}
+			pages->components = components;
+			pages->images = images;
+			pages->bottom = bottom;
+
+			size = data.size();
+			std::error_code error;
+			std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+			return pages;
 		}
 
-		template<component U>
-		Image& Append(U component) {
-			m_content.append(component.GetContent().front());
-			return *this;
+		// moves path to the most recently used end of the files
+		void Touch(const std::filesystem::path& path, size_t size) {
+			auto name = path.string();
+			auto it = m_fileIndex.find(name);
+			if (it != m_fileIndex.end()) {
+				m_diskSize -= it->second->size;
+				m_files.erase(it->second);
+			}
+			m_files.push_back({ name, size });
+			m_fileIndex[name] = std::prev(m_files.end());
+			m_diskSize += size;
 		}
 
-	public:
-		float GetDrawPadding() const {
-			auto captionPadding = m_caption.Empty() ? 0.0 : m_caption.GetFontSize();
-			return PDF_SECTION_PADDING + captionPadding;
+		// drops the least recently used files from the bookkeeping until the rest fits the budget and
+		// returns their paths, the caller removes them once it let go of the lock
+		std::vector<std::string> TrimDisk() {
+			std::vector<std::string> trimmed;
+			while (m_diskSize > m_diskBudget && m_files.size() > 1) {
+				m_diskSize -= m_files.front().size;
+				m_fileIndex.erase(m_files.front().path);
+				trimmed.push_back(std::move(m_files.front().path));
+				m_files.pop_front();
+			}
+			return trimmed;
 		}
 
-	public:
-		std::vector<std::string> GetContent() const {
-			auto ret = std::vector<std::string>();
-			ret.push_back(m_content);
-			return ret;
+		static void Remove(const std::vector<std::string>& paths) {
+			std::error_code error;
+			for (auto& path : paths) {
+				std::filesystem::remove(path, error);
+			}
 		}
 
-	public:
-		Vector2 Size() { return m_size; }
-		Vector2 Size() const { return m_size; }
+	private:
+		mutable std::mutex m_mutex;
+		size_t m_budget;
+		size_t m_size = 0;
+		std::unordered_map<std::string, Entry> m_entries;
+		// least recently used first
+		std::list<const std::string*> m_order;
+		std::filesystem::path m_directory;
+		size_t m_diskBudget = PAGE_CACHE_DISK_BUDGET;
+		size_t m_diskSize = 0;
+		// least recently used first, and by path
+		std::list<File> m_files;
+		std::unordered_map<std::string, std::list<File>::iterator> m_fileIndex;
+		Stats m_stats;
+	};
 
-		int32_t Count() { return m_componentCount; }
-		int32_t Count() const { return m_componentCount; }
+	PageCache& GetPageCache() {
+		static PageCache cache;
+		return cache;
+	}
 
-		std::string_view Content() { return m_content; }
-		std::string_view Content() const { return m_content; }
+	enum class RenderStatus {
+		Done,
+		Failed,
+		Cancelled,
+		TimedOut,
+		// a RenderScheduler had no room left in the queue of its priority
+		Rejected
+	};
 
-		Vector2 StartPosition() { return m_startPosition; }
-		Vector2 StartPosition() const { return m_startPosition; }
+	// How a GeneratePDF ended, with the numbers of the render
+	struct RenderResult {
+		RenderStatus status = RenderStatus::Failed;
+		// the pdf written, empty when the document was kept in memory
+		std::string path;
+		// the document itself when no path was given
+		std::string pdf;
+		size_t pages = 0;
+		size_t bytes = 0;
+		// from the call until the render started, and the render itself
+		std::chrono::microseconds queued{};
+		std::chrono::microseconds rendering{};
+	};
 
-		Vector2 RealDrawPosition() { return realDrawCoord; }
-		Vector2 RealDrawPosition() const { return realDrawCoord; }
+	struct RenderOptions {
+		// the renderers are killed once the render takes longer than this from the call on, 0 for no limit
+		std::chrono::milliseconds timeout{};
+		// cancels the render, queued or running
+		std::stop_token stop;
+		// called on the rendering thread once the render ended, however it ended
+		std::function<void(const RenderResult&)> onComplete;
+	};
 
-	private:
-		Direction direction;
-		// the real draw position
-		Vector2 realDrawCoord;
-		// the id that's corresponding to the image path
-		std::string m_imageId;
-		// the image scaling 
-		float scaling;
-		// the text caption that's attached to the 
-		Text m_caption;
-		// the spacing between the caption and the image
-		float captionSpacing = 0.5;
-		// image index
-		inline static size_t m_index = {};
+	// Everything one render needs, copied out of its PDFTextTable so it may outlive the table
+	struct RenderJob {
+		std::string renderer;
+		// names the page files of the renderer on windows
+		std::string name;
+		size_t shards = 1;
+		std::vector<std::string> scripts;
+		std::chrono::steady_clock::time_point start;
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+		std::stop_token stop;
 	};
 
-	class PDFTextTable {
-	public:
-		PDFTextTable(std::string_view tableName) : m_tableName(tableName) {
-			if (!m_ctxInitialized) {
-				InitContext();
-				m_ctxInitialized = true;
+	// runs the renderer over the scripts of consecutive pages from first on, the pdf is the output of
+	// a run that exited with 0
+	lxd::ProcessResult RenderPages(const RenderJob& job, size_t first, std::span<const std::string> scripts) {
+#ifndef _WIN32
+		// the pages go to the renderer as memfds and the pdf comes back over its stdout, nothing
+		// is written to disk and no viewer is opened
+		lxd::ProcessOptions options{ {}, job.stop };
+		if (job.deadline != std::chrono::steady_clock::time_point::max()) {
+			auto left = std::chrono::ceil<std::chrono::milliseconds>(job.deadline - std::chrono::steady_clock::now());
+			options.timeout = std::max(left, std::chrono::milliseconds(1));
+		}
+		std::vector<std::string_view> inputs(scripts.begin(), scripts.end());
+		return lxd::RunProcess({ job.renderer, "create", "-o", "/dev/stdout" }, inputs, options);
+#else
+		// mutool reads every page from a file, they exist only while it runs, in a directory of this job
+		auto pageDir = UniqueTempPath(std::filesystem::path(job.name).stem().string());
+		std::filesystem::create_directories(pageDir);
+		std::string pageNames;
+		for (size_t i = 0; i < scripts.size(); i++) {
+			auto pageName(job.name);
+			auto pagePath = pageDir / pageName.insert(pageName.find('.'), std::to_string(first + i));
+			lxd::WriteFile(pagePath.wstring().c_str(), scripts[i].data(), scripts[i].size());
+			pageNames.append(fmt::format("\"{}\" ", pagePath.string()));
+		}
+		auto pdfPath = pageDir / "pages.pdf";
+
+		CString cmdLine(fmt::format("{} create -o \"{}\" {}", job.renderer, pdfPath.string(), pageNames).c_str());
+		auto nStrBuffer = cmdLine.GetLength() + 10;
+
+		PROCESS_INFORMATION processInformation = { 0 };
+		STARTUPINFO startupInfo = { 0 };
+		startupInfo.cb = sizeof(startupInfo);
+		BOOL result = CreateProcess(NULL, cmdLine.GetBuffer(nStrBuffer), NULL, NULL, FALSE,
+			NORMAL_PRIORITY_CLASS | CREATE_NO_WINDOW, NULL, NULL, &startupInfo, &processInformation);
+		cmdLine.ReleaseBuffer();
+
+		lxd::ProcessResult pdf;
+		if (!result) {
+			// CreateProcess() failed
+			// Get the error from the system
+			LPVOID lpMsgBuf;
+			DWORD dw = GetLastError();
+			FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+				NULL, dw, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPTSTR)&lpMsgBuf, 0, NULL);
+
+			// Display the error
+			CString strError = (LPTSTR)lpMsgBuf;
+			printf("::executeCommandLine() failed at CreateProcess()\nCommand=%s\nMessage=%s\n\n", cmdLine, strError);
+
+			// Free resources created by the system
+			LocalFree(lpMsgBuf);
+		}
+		else {
+			// Successfully created the process. Wait for it to finish in slices, a stop or the deadline kills it
+			while (WaitForSingleObject(processInformation.hProcess, 50) == WAIT_TIMEOUT) {
+				pdf.stopped = job.stop.stop_requested();
+				pdf.timedOut = !pdf.stopped && std::chrono::steady_clock::now() >= job.deadline;
+				if (pdf.stopped || pdf.timedOut) {
+					TerminateProcess(processInformation.hProcess, 1);
+					WaitForSingleObject(processInformation.hProcess, INFINITE);
+					break;
+				}
+			}
+			DWORD exitCode = 1;
+			GetExitCodeProcess(processInformation.hProcess, &exitCode);
+			if (!pdf.stopped && !pdf.timedOut) {
+				pdf.exitCode = static_cast<int>(exitCode);
+				if (exitCode == 0) {
+					pdf.output = lxd::ReadFile(pdfPath.wstring().c_str());
+				}
 			}
-			CreatePdfFile();
+
+			// Close the handles.
+			CloseHandle(processInformation.hProcess);
+			CloseHandle(processInformation.hThread);
 		}
 
-		~PDFTextTable() {
-			for (auto& file : m_files)
-				delete file;
+		std::error_code error;
+		std::filesystem::remove_all(pageDir, error);
+		return pdf;
+#endif
+	}
 
-#ifdef DELETE_TXT_FILE
-			// delete the txt files
-			for (int i = 0; i < m_files.size(); i++) {
-				std::string txtFileName{ m_tableName };
-				txtFileName.insert(txtFileName.find('.'), std::to_string(i));
-				try {
-					if (std::filesystem::remove(txtFileName))
-						std::cout << "file " << txtFileName << " deleted.\n";
-					else
-						std::cout << "file " << txtFileName << " not found.\n";
-				}
-				catch (const std::filesystem::filesystem_error& err) {
-					std::cout << "filesystem error: " << err.what() << '\n';
+	// Merges the outputs of the renderer runs over consecutive pages of job in order and writes the pdf into
+	// path, or into result when path is empty
+	RenderStatus FinishDocument(const RenderJob& job, std::vector<lxd::ProcessResult>& pdfs, const std::string& path, RenderResult& result) {
+		for (auto& pdf : pdfs) {
+			if (pdf.stopped) {
+				return RenderStatus::Cancelled;
+			}
+			if (pdf.timedOut) {
+				return RenderStatus::TimedOut;
+			}
+			if (pdf.exitCode != 0) {
+				print({ fmt::format("Renderer {} failed with exit code {}\n", job.renderer, pdf.exitCode) });
+				return RenderStatus::Failed;
+			}
+		}
+
+		std::string pdf;
+		if (pdfs.size() == 1) {
+			pdf = std::move(pdfs[0].output);
+		}
+		else {
+			PdfMerger merger;
+			for (size_t i = 0; i < pdfs.size(); i++) {
+				if (!merger.Add(pdfs[i].output)) {
+					print({ fmt::format("Pages of shard {} could not be merged\n", i) });
+					return RenderStatus::Failed;
 				}
 			}
-#endif
+			pdf = merger.Finish();
+		}
+
+		result.bytes = pdf.size();
+		if (path.empty()) {
+			result.pdf = std::move(pdf);
+		}
+		else if (lxd::WriteFile(Utf8ToUnicode(path).c_str(), pdf.data(), pdf.size())) {
+			result.path = path;
+		}
+		else {
+			return RenderStatus::Failed;
+		}
+		return RenderStatus::Done;
+	}
+
+	// Renders the pages of job into path, or into the result when path is empty. Contiguous runs of pages
+	// go to renderer processes of their own at once and are merged in order
+	RenderResult RenderDocument(const RenderJob& job, const std::string& path) {
+		auto begin = std::chrono::steady_clock::now();
+		RenderResult result;
+		result.pages = job.scripts.size();
+		result.queued = std::chrono::duration_cast<std::chrono::microseconds>(begin - job.start);
+		auto finish = [&](RenderStatus status) {
+			result.status = status;
+			result.rendering = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin);
+			return std::move(result);
+		};
+		if (job.stop.stop_requested()) {
+			return finish(RenderStatus::Cancelled);
+		}
+		if (begin >= job.deadline) {
+			return finish(RenderStatus::TimedOut);
+		}
+
+		// the shards wait for their renderers on the render pool, the caller helps there until they're done
+		auto shards = std::clamp<size_t>(job.shards ? job.shards : GetThreadPool().size(), 1, std::max<size_t>(job.scripts.size(), 1));
+		std::vector<lxd::ProcessResult> pdfs(shards);
+		GetRenderPool().parallelFor(shards, [&](size_t shard) {
+			auto first = job.scripts.size() * shard / shards, last = job.scripts.size() * (shard + 1) / shards;
+			pdfs[shard] = RenderPages(job, first, std::span(job.scripts).subspan(first, last - first));
+		});
+		return finish(FinishDocument(job, pdfs, path, result));
+	}
+
+	// The counters of one document. The font data every document shares is read only, see GetFontMetrics,
+	// so tables rendering on different threads don't share anything they write
+	struct DocumentContext {
+		// components drawn so far
+		size_t components = 0;
+		// image resources declared so far, named I0, I1, ... in order
+		size_t images = 0;
+	};
+
+	class PDFTextTable {
+	public:
+		PDFTextTable(std::string_view tableName) : m_tableName(tableName) {
+			CreatePage();
 		}
 
 	public:
-		void InitContext() {
-			InitCharWidthPool();
+		// renders the pages into filePath, opening the pdf on windows
+		RenderResult GeneratePDF(const std::string& filePath) {
+			FlushPage();
+			auto result = RenderDocument(MakeRenderJob({}), PdfFilePath(filePath));
+#ifdef _WIN32
+			if (result.status == RenderStatus::Done) {
+				ShellExecute(NULL, NULL, result.path.data(), NULL, NULL, SW_SHOWNORMAL);
+			}
+#endif
+			return result;
 		}
 
-		void GeneratePDF(const std::string& filePath) {
-			auto pdfFilePath = fmt::format("{}{}", filePath, (filePath.find(".pdf") == std::string::npos) ? ".pdf" : "");
-
-			std::string pageNames;
-			for (size_t i = 0; i < m_files.size(); i++) {
-				auto tableName(m_tableName);
-				pageNames.append(tableName.insert(tableName.find('.'), std::to_string(i))).append(" ");
+		// renders the pages and waits for them on the calling thread, like GeneratePDF but into memory when filePath
+		// is empty and without opening the pdf. A layout pool worker is blocked for the render, GeneratePDFAsync isn't
+		RenderResult RenderPDF(const std::string& filePath, const RenderOptions& options = {}) {
+			FlushPage();
+			auto result = RenderDocument(MakeRenderJob(options), filePath.empty() ? std::string() : PdfFilePath(filePath));
+			if (options.onComplete) {
+				options.onComplete(result);
 			}
+			return result;
+		}
 
-			CString cmdLine(fmt::format("mutool.exe create -o {} {}", pdfFilePath, pageNames).c_str());
-			auto nStrBuffer = cmdLine.GetLength() + 10;
-
-			PROCESS_INFORMATION processInformation = { 0 };
-			STARTUPINFO startupInfo = { 0 };
-			startupInfo.cb = sizeof(startupInfo);
-			BOOL result = CreateProcess(NULL, cmdLine.GetBuffer(nStrBuffer), NULL, NULL, FALSE,
-				NORMAL_PRIORITY_CLASS | CREATE_NO_WINDOW, NULL, NULL, &startupInfo, &processInformation);
-			cmdLine.ReleaseBuffer();
+		// renders the pages on the render pool and returns right away, the table may go on with more pages or
+		// be destroyed meanwhile. An empty filePath keeps the pdf in RenderResult::pdf, nothing is opened
+		std::future<RenderResult> GeneratePDFAsync(const std::string& filePath, RenderOptions options = {}) {
+			FlushPage();
+			auto path = filePath.empty() ? std::string() : PdfFilePath(filePath);
+			return GetRenderPool().async([job = MakeRenderJob(options), path, onComplete = std::move(options.onComplete)]() {
+				auto result = RenderDocument(job, path);
+				if (onComplete) {
+					onComplete(result);
+				}
+				return result;
+			});
+		}
 
-			if (!result) {
-				// CreateProcess() failed
-				// Get the error from the system
-				LPVOID lpMsgBuf;
-				DWORD dw = GetLastError();
-				FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-					NULL, dw, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPTSTR)&lpMsgBuf, 0, NULL);
+		// the job of the pages drawn so far, for callers that run RenderDocument themselves
+		RenderJob PrepareRender(const RenderOptions& options = {}) {
+			FlushPage();
+			return MakeRenderJob(options);
+		}
 
-				// Display the error
-				CString strError = (LPTSTR)lpMsgBuf;
-				printf("::executeCommandLine() failed at CreateProcess()\nCommand=%s\nMessage=%s\n\n", cmdLine, strError);
+		static std::string PdfFilePath(const std::string& filePath) {
+			return fmt::format("{}{}", filePath, (filePath.find(".pdf") == std::string::npos) ? ".pdf" : "");
+		}
 
-				// Free resources created by the system
-				LocalFree(lpMsgBuf);
+	private:
+		// the scripts are read now, the pages of the table may change once the job is made
+		RenderJob MakeRenderJob(const RenderOptions& options) {
+			DrainPipeline();
+			RenderJob job{ m_renderer, m_tableName, m_renderShards };
+			for (size_t i = 0; i < m_pages.Count(); i++) {
+				job.scripts.push_back(m_pages.Read(i));
 			}
-			else {
-				// Successfully created the process.  Wait for it to finish.
-				WaitForSingleObject(processInformation.hProcess, INFINITE);
-
-				// ShellExecute(NULL, NULL, pdfFilePath.data(), NULL, NULL, SW_SHOWNORMAL);
-				ShellExecute(NULL, NULL, pdfFilePath.data(), NULL, NULL, SW_SHOWNORMAL);
-
-				// Close the handles.
-				CloseHandle(processInformation.hProcess);
-				CloseHandle(processInformation.hThread);
+			job.start = std::chrono::steady_clock::now();
+			if (options.timeout.count() > 0) {
+				job.deadline = job.start + options.timeout;
 			}
+			job.stop = options.stop;
+			return job;
 		}
 
 	public:
 		// ļӿ
-		void CreatePdfFile() {
-			m_files.push_back(new lxd::File(Utf8ToUnicode(GetCurFileName()), lxd::WriteOnly | lxd::Truncate));
-			SetCurFile(m_files.back());
+		void CreatePage() {
+			FlushPage();
+			m_page->newPage = true;
 			ResetBottom();
 
-			const std::string initConfig("%%MediaBox 0 0 707 1000\r\n%%Font TmRm Times-Roman\r\n%%Font TmBd Times-Bold \r\n%%CJKFont Song zh-Hans\r\n%%CJKFont SnBd zh-Hans\r\n");
-			m_currFile->write(initConfig.data(), initConfig.size());
+			// goes out with the rest of the page, in the same write
+			m_page->list.RecordRaw("%%MediaBox 0 0 707 1000\r\n%%Font TmRm Times-Roman\r\n%%Font TmBd Times-Bold \r\n%%CJKFont Song zh-Hans\r\n%%CJKFont SnBd zh-Hans\r\n");
 
 			if (m_enableHeader) {
 				ConfigHeader();
 			}
 		}
 
+		// Starts a new page and draws it through draw, unless a page was drawn from the same key before, by this
+		// or any other table: then the pages draw made back then are spliced in without layout or formatting.
+		// key must hold everything draw reads, the font metrics, precision and the images loaded so far are
+		// added here. Later draws go on with the last of the pages either way
+		template <class Draw>
+		void DrawPage(PageKey key, Draw&& draw) {
+			key.Add(GetFontMetrics().Bytes()).Add(m_precision).Add(m_context.images).Add(m_enableHeader);
+			auto& cache = GetPageCache();
+			FlushPage();
+			DrainPipeline();
+			if (auto cached = cache.Find(key)) {
+				for (const auto& script : cached->scripts) {
+					m_pages.NewPage();
+					m_pages.Append(script);
+				}
+				m_context.components += cached->components;
+				m_context.images += cached->images;
+				m_bottom = cached->bottom;
+				m_lastDrawPadding = cached->drawPadding;
+				m_cullStats.components += cached->culled.components;
+				m_cullStats.commands += cached->culled.commands;
+				m_cullStats.textRuns += cached->culled.textRuns;
+				return;
+			}
+
+			auto first = m_pages.Count();
+			auto components = m_context.components, images = m_context.images;
+			auto culled = m_cullStats;
+			CreatePage();
+			draw();
+			FlushPage();
+			DrainPipeline();
+
+			CachedPages pages;
+			for (auto i = first; i < m_pages.Count(); i++) {
+				pages.scripts.push_back(m_pages.Read(i));
+			}
+			pages.components = m_context.components - components;
+			pages.images = m_context.images - images;
+			pages.bottom = m_bottom;
+			pages.drawPadding = m_lastDrawPadding;
+			pages.culled = { m_cullStats.components - culled.components, m_cullStats.commands - culled.commands,
+				m_cullStats.textRuns - culled.textRuns };
+			cache.Insert(key, std::move(pages));
+		}
+
 		std::string LoadImage(const std::string imagePath) {
-			if (std::filesystem::exists(imagePath.data())) {
-				auto imageData = fmt::format("%%Image I{} {}\r\n", m_imageIndex, imagePath);
-				m_currFile->write(imageData.data(), imageData.size());
-				return fmt::format("/I{}", m_imageIndex);
+			if (GetImageHeader(imagePath).valid) {
+				auto index = m_context.images++;
+				m_page->list.RecordRaw(fmt::format("%%Image I{} {}\r\n", index, imagePath));
+				return fmt::format("/I{}", index);
 			}
 			print({ fmt::format("Image path: {} not found\n", imagePath) });
 			return std::string();
@@ -1080,13 +3958,11 @@ namespace pdf {
 				for (int i = 1; i <= 8; i++) {
 					auto fdi = j * 10 + i;
 					auto imagePath = fmt::format("image/{}{}.png", prefix, fdi);
-					LoadImage(imagePath);
-					int32_t width = {}, height = {}, comp = {};
-					stbi_info(imagePath.data(), &width, &height, &comp);
+					auto header = GetImageHeader(imagePath);
 					auto imageInfo = ImageInfo();
-					imageInfo.m_imageId = fmt::format("/I{}", m_imageIndex++);
-					imageInfo.width = width;
-					imageInfo.height = height;
+					imageInfo.m_imageId = LoadImage(imagePath);
+					imageInfo.width = header.width;
+					imageInfo.height = header.height;
 					m_fdiMap.insert({ fdi, imageInfo });
 				}
 			}
@@ -1097,11 +3973,11 @@ namespace pdf {
 		template<hasContent T>
 		void Draw(const T& component) {}
 
-		template<>
 		void Draw(const Rect& component) {
+			++m_context.components;
 			auto bottom = component.StartPosition().y - component.Size().y;
-			const auto& content = component.Content();
-			m_currFile->write(content.data(), content.size());
+			if (OnPage(component.Bounds()))
+				component.Record(m_page->list);
 
 			if (component.m_type == Rect::Type::Block) {
 				m_lastDrawPadding = component.Size().y;
@@ -1112,17 +3988,29 @@ namespace pdf {
 			}
 		}
 
-		template<>
 		void Draw(const Circle& component) {
-			auto content = component.Content();
-			m_currFile->write(content.data(), content.size());
+			++m_context.components;
+			if (OnPage(component.Bounds()))
+				component.Record(m_page->list);
+		}
+
+		void Draw(const Path& component) {
+			++m_context.components;
+			if (OnPage(component.Bounds()))
+				component.Record(m_page->list);
+		}
+
+		void Draw(const Batch& component) {
+			++m_context.components;
+			if (OnPage(component.Bounds()))
+				component.Record(m_page->list);
 		}
 
-		template<>
 		void Draw(const Streak& component) {
+			++m_context.components;
 			auto bottom = component.StartPosition().y;
-			const auto& content = component.Content();
-			m_currFile->write(content.data(), content.size());
+			if (OnPage(component.Bounds()))
+				component.Record(m_page->list);
 
 			m_lastDrawPadding = PDF_SECTION_PADDING;
 			if (bottom < m_bottom) {
@@ -1130,34 +4018,66 @@ namespace pdf {
 			}
 		}
 
-		template<>
 		void Draw(const Image& component) {
-			auto bottom = component.RealDrawPosition().y;
-			const auto img = component.Content();
-			m_currFile->write(img.data(), img.size());
+			++m_context.components;
+			component.Record(m_page->list);
+			UpdateBottom(component.RealDrawPosition().y, component.GetDrawPadding());
+		}
 
-			m_lastDrawPadding = component.GetDrawPadding();
-			if (bottom < m_bottom) {
-				m_bottom = bottom;
+		void Draw(const Text& component) {
+			++m_context.components;
+			auto& text = const_cast<Text&>(component);
+			text.CalcLayout();
+			text.Record(m_page->list, [this]() -> DisplayList& { return NextPage(); });
+			UpdateBottom(text.GetBottom(), text.GetFontSize() + PDF_LINE_PADDING);
+		}
+
+		void Draw(const Table& component) {
+			++m_context.components;
+			auto& table = const_cast<Table&>(component);
+			table.CalcLayout();
+			table.Record(m_page->list, [this]() -> DisplayList& { return NextPage(); });
+			UpdateBottom(table.GetBottom(), PDF_SECTION_PADDING);
+		}
+
+		void Draw(const Container& component) {
+			++m_context.components;
+			auto& container = const_cast<Container&>(component);
+			container.CalcLayout();
+			if (MoveToNextPage(container)) {
+				CreatePage();
 			}
+			container.Record(m_page->list);
+			UpdateBottom(PDF_HEIGHT - container.Bounds().Bottom(), PDF_SECTION_PADDING);
 		}
 
-		template<>
-		void Draw(const Text& component) {
-			const_cast<Text*>(&component)->CalcLayout();
-			auto textVec = component.GetContent();
+		// Lays out the batch concurrently on the shared pool and emits the results in batch order,
+		// the components must not depend on each other's placement
+		void DrawBatch(std::vector<LayoutItem> components) {
+			m_context.components += components.size();
+			std::vector<LayoutResult> results(components.size());
+			ParallelFor(components.size(), [&](size_t i) {
+				results[i] = std::visit([](auto& component) { return Layout(component); }, components[i]);
+			});
+
+			for (const auto& result : results) {
+				Emit(result);
+			}
+		}
 
-			for (const auto& text : textVec) {
-				m_currFile->write(text.data(), text.size());
-				if (text != textVec.back()) {
-					CreatePdfFile();
-				}
+		void Emit(const LayoutResult& result) {
+			if (result.nextPage) {
+				CreatePage();
 			}
 
-			m_lastDrawPadding = component.GetFontSize() + PDF_LINE_PADDING;
-			if (component.GetBottom() < m_bottom) {
-				m_bottom = component.GetBottom();
+			for (size_t i = 0; i < result.pages.size(); i++) {
+				if (i > 0) {
+					CreatePage();
+				}
+				m_page->list.Append(result.pages[i]);
 			}
+
+			UpdateBottom(result.bottom, result.drawPadding);
 		}
 
 	public:
@@ -1218,7 +4138,7 @@ namespace pdf {
 					ConfigFooter();
 				}
 
-				CreatePdfFile();
+				CreatePage();
 
 				return PDF_PADDING;
 			}
@@ -1255,6 +4175,47 @@ namespace pdf {
 		}
 
 	public:
+		// the program GeneratePDF runs, PDF_RENDERER or a stand-in taking the same arguments
+		void SetRenderer(std::string_view renderer) {
+			m_renderer = renderer;
+		}
+
+		// renderer processes GeneratePDF splits the pages over, 0 for one per core
+		void SetRenderShards(size_t shards) {
+			m_renderShards = shards;
+		}
+
+		// decimals printed for coordinates, sizes and colors of the pages written from now on
+		void SetPrecision(int precision) {
+			m_precision = precision;
+		}
+
+		// the components drawn into this document so far
+		size_t GetComponentCount() const {
+			return m_context.components;
+		}
+
+		// what was left out because it lies off the page, up to the last page written
+		const CullStats& GetCullStats() {
+			DrainPipeline();
+			return m_cullStats;
+		}
+
+		// serializes and stores the pages on two threads of their own behind layout, at most depth pages
+		// between two stages. 0 goes back to doing it all on the drawing thread
+		void SetPipeline(size_t depth) {
+			DrainPipeline();
+			m_pipeline.reset();
+			if (depth > 0) {
+				m_pipeline = std::make_unique<PagePipeline>(m_pages, depth);
+			}
+		}
+
+		// time spent per stage, all zero without a pipeline
+		std::array<StageStats, PagePipeline::Stages> GetPipelineStats() const {
+			return m_pipeline ? m_pipeline->Stats() : std::array<StageStats, PagePipeline::Stages>{};
+		}
+
 		void ConfigHeader() {
 
 		}
@@ -1269,30 +4230,495 @@ namespace pdf {
 			m_bottom = PDF_HEIGHT;
 		}
 
-		void SetCurFile(lxd::File* file) { m_currFile = file; }
-		std::string GetCurFileName() {
-			auto res(m_tableName);
-			return res.insert(res.find('.'), std::to_string(m_files.size()));
+		// the list of the following page, for components that run over the current one
+		DisplayList& NextPage() {
+			CreatePage();
+			return m_page->list;
+		}
+
+		// the simple components are tested before they are recorded, everything else by the writer
+		bool OnPage(const BoundingBox& bounds) {
+			if (bounds.Inflated(PDF_CULL_MARGIN).Intersects(PDF_PAGE_BOX))
+				return true;
+			m_cullStats.components++;
+			return false;
+		}
+
+		void UpdateBottom(float bottom, float drawPadding) {
+			m_lastDrawPadding = drawPadding;
+			if (bottom < m_bottom) {
+				m_bottom = bottom;
+			}
+		}
+
+		// serializes the recorded page into the page store and releases the page arena in one go, or hands
+		// the page to the pipeline and goes on with an empty one
+		void FlushPage() {
+			if (!m_page->newPage && m_page->list.Empty()) return;
+
+			if (m_pipeline) {
+				m_page->precision = m_precision;
+				m_pipeline->Submit(std::move(m_page));
+				m_page = m_pipeline->Acquire();
+				return;
+			}
+
+			ScriptWriter::Write(m_page->list, m_page->script, m_precision, PDF_PAGE_BOX, m_cullStats);
+			if (m_page->newPage) {
+				m_pages.NewPage();
+			}
+			m_pages.Append(m_page->script);
+			m_page->Reset();
+		}
+
+		// the pages still in the pipeline are stored before anything reads the store
+		void DrainPipeline() {
+			if (m_pipeline) {
+				m_pipeline->Drain(m_cullStats);
+			}
 		}
 
 	public:
 		size_t m_bottom = PDF_HEIGHT;
 	private:
 		std::string m_tableName;
-		lxd::File* m_currFile;
-		std::vector<lxd::File*> m_files;
+		PageStore m_pages;
+		// serializes and stores the pages behind layout when enabled, goes before the store it writes to
+		std::unique_ptr<PagePipeline> m_pipeline;
+		// draw calls of the current page, serialized when the page is complete
+		std::unique_ptr<PageBuffer> m_page = std::make_unique<PageBuffer>();
+		// decimals of the numbers in the page scripts
+		int m_precision = PDF_OPERAND_PRECISION;
+		std::string m_renderer = PDF_RENDERER;
+		size_t m_renderShards = 1;
+		CullStats m_cullStats;
 	private:
 		float m_lastDrawPadding = {};
 		float m_lastTextDrawLength = {};
-		inline static size_t m_imageIndex = {};
 		FIGURE m_lastDrawFigure = FIGURE::DEFAULT;
 	private:
 		std::map<int32_t, ImageInfo> m_fdiMap;
 	private:
 		bool m_enableHeader = true;
 		bool m_enableFooter = true;
+		DocumentContext m_context;
+	};
+
+	// One report of a batch: build draws it into a new table named name, which is rendered into path
+	struct ReportJob {
+		std::string name;
+		std::string path;
+		std::function<void(PDFTextTable&)> build;
+	};
+
+	struct BatchResult {
+		// in the order of the jobs
+		std::vector<RenderResult> reports;
+		size_t done = 0;
+		std::chrono::microseconds elapsed{};
+
+		double DocumentsPerSecond() const {
+			return elapsed.count() ? done * 1e6 / elapsed.count() : 0.0;
+		}
+	};
+
+	// Lays out and renders all jobs in this process. The layouts run on the pool, as many at once as it has
+	// threads, and every finished layout hands its render to the render pool, so a worker goes on with the
+	// next report instead of waiting for a renderer. The font metrics and image headers are read once for
+	// the whole batch, every report has a context of its own. The timeout and onComplete of options apply
+	// to each report, stop to the whole batch
+	BatchResult GenerateReports(std::span<const ReportJob> jobs, const RenderOptions& options = {}) {
+		BatchResult batch;
+		batch.reports.resize(jobs.size());
+		std::vector<std::future<RenderResult>> renders(jobs.size());
+		auto begin = std::chrono::steady_clock::now();
+		// one broken report must not take the rest of the night down with it
+		auto failed = [&jobs, &batch](size_t i, std::string_view reason) {
+			print({ fmt::format("Report {} failed: {}\n", jobs[i].name, reason) });
+			batch.reports[i].status = RenderStatus::Failed;
+		};
+		ParallelFor(jobs.size(), [&](size_t i) {
+			if (options.stop.stop_requested()) {
+				batch.reports[i].status = RenderStatus::Cancelled;
+				return;
+			}
+			try {
+				PDFTextTable table(jobs[i].name);
+				jobs[i].build(table);
+				renders[i] = table.GeneratePDFAsync(jobs[i].path, options);
+			}
+			catch (const std::exception& e) {
+				failed(i, e.what());
+			}
+			catch (...) {
+				failed(i, "unknown exception");
+			}
+		});
+		for (size_t i = 0; i < jobs.size(); i++) {
+			if (!renders[i].valid())
+				continue;
+			try {
+				batch.reports[i] = renders[i].get();
+			}
+			catch (const std::exception& e) {
+				failed(i, e.what());
+			}
+			catch (...) {
+				failed(i, "unknown exception");
+			}
+		}
+		batch.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin);
+		batch.done = std::count_if(batch.reports.begin(), batch.reports.end(),
+			[](const RenderResult& report) { return report.status == RenderStatus::Done; });
+		return batch;
+	}
+
+#ifndef _WIN32
+	// Renders reports for local clients over a unix socket. The process stays up between requests, so the
+	// font metrics, image headers, the registered builders and the pool are warm for every report.
+	// A request is one frame of the report kind, a '\0' and the arguments of its builder, the answer one
+	// frame of the RenderStatus as a byte followed by the pdf
+	class ReportServer {
+	public:
+		using Builder = std::function<void(PDFTextTable&, std::string_view args)>;
+
+		explicit ReportServer(const std::string& path) : m_server(path) {}
+		~ReportServer() {
+			Stop();
+		}
+
+		bool IsOpen() const {
+			return m_server.isOpen();
+		}
+
+		// the builders are read by every client thread at once, register them all before Run
+		void Register(const std::string& kind, Builder builder) {
+			m_builders[kind] = std::move(builder);
+		}
+
+		// serves every client on a thread of its own until Stop, then waits for them
+		void Run() {
+			while (true) {
+				auto socket = std::make_shared<lxd::LocalSocket>(m_server.accept());
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (!socket->isOpen() || m_stopped) {
+					break;
+				}
+				// clients that hung up meanwhile
+				std::erase_if(m_clients, [](const Client& client) {
+					return client.done.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+				});
+				m_clients.push_back({ socket, std::async(std::launch::async, [this, socket]() { Serve(*socket); }) });
+			}
+
+			std::vector<Client> clients;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				clients.swap(m_clients);
+			}
+			// the futures of std::async wait for their threads
+		}
+
+		// may be called from any thread, hangs up on the clients, a report being rendered is finished first
+		void Stop() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopped = true;
+			for (auto& client : m_clients) {
+				client.socket->shutdown();
+			}
+			m_server.close();
+		}
+
+	private:
+		struct Client {
+			std::shared_ptr<lxd::LocalSocket> socket;
+			std::future<void> done;
+		};
+
+		void Serve(lxd::LocalSocket& socket) {
+			std::string request;
+			while (socket.readFrame(request, MAX_REQUEST)) {
+				auto result = Render(request);
+				std::string response(1, static_cast<char>(result.status));
+				response.append(result.pdf);
+				if (!socket.writeFrame(response)) {
+					break;
+				}
+			}
+		}
+
+		RenderResult Render(std::string_view request) {
+			auto split = request.find('\0');
+			auto kind = std::string(request.substr(0, split));
+			auto args = (split == std::string_view::npos) ? std::string_view() : request.substr(split + 1);
+			auto builder = m_builders.find(kind);
+			if (builder == m_builders.end()) {
+				print({ fmt::format("Unknown report {}\n", kind) });
+				return RenderResult();
+			}
+			try {
+				PDFTextTable table(fmt::format("{}.txt", kind));
+				builder->second(table, args);
+				return table.RenderPDF(std::string());
+			}
+			catch (const std::exception& e) {
+				print({ fmt::format("Report {} failed: {}\n", kind, e.what()) });
+				return RenderResult();
+			}
+		}
+
+	private:
+		static constexpr size_t MAX_REQUEST = 1 << 20;
+
+		lxd::LocalServer m_server;
+		std::map<std::string, Builder> m_builders;
+		std::mutex m_mutex;
+		std::vector<Client> m_clients;
+		bool m_stopped = false;
+	};
+
+	// The other end of a ReportServer, one request at a time
+	class ReportClient {
+	public:
+		explicit ReportClient(const std::string& path) : m_socket(lxd::LocalSocket::connect(path)) {}
+
+		bool IsConnected() const {
+			return m_socket.isOpen();
+		}
+
+		// the pdf comes back in RenderResult::pdf, rendering is the round trip as the client saw it
+		RenderResult Render(std::string_view kind, std::string_view args = {}) {
+			auto begin = std::chrono::steady_clock::now();
+			std::string request(kind);
+			request.push_back('\0');
+			request.append(args);
+
+			RenderResult result;
+			std::string response;
+			if (m_socket.writeFrame(request) && m_socket.readFrame(response) && !response.empty()) {
+				result.status = static_cast<RenderStatus>(response[0]);
+				result.pdf = response.substr(1);
+				result.bytes = result.pdf.size();
+			}
+			result.rendering = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin);
+			return result;
+		}
+
+	private:
+		lxd::LocalSocket m_socket;
+	};
+#endif
+
+	enum class RenderPriority {
+		// somebody waits for the document, goes before all bulk work
+		Interactive,
+		Bulk
+	};
+
+	struct LatencyStats {
+		size_t count = 0;
+		std::chrono::microseconds p50{};
+		std::chrono::microseconds p99{};
+	};
+
+	// Renders documents on threads of its own, interactive ones before bulk ones. Within a priority the
+	// earliest deadline goes first, then the order of submission. Bulk documents are rendered a slice of
+	// pages at a time and step aside between two slices once an interactive render waits, so a chart printed
+	// during the nightly export waits for one slice at most instead of whole documents
+	class RenderScheduler {
+	public:
+		explicit RenderScheduler(size_t threads = GetThreadPool().size(), size_t queueLimit = 256, size_t slicePages = 8)
+			: m_queueLimit(queueLimit), m_slicePages(std::max<size_t>(slicePages, 1)) {
+			for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+				m_threads.emplace_back([this]() { Work(); });
+			}
+		}
+
+		// renders everything queued before it returns
+		~RenderScheduler() {
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stopping = true;
+			}
+			m_wake.notify_all();
+			for (auto& thread : m_threads) {
+				thread.join();
+			}
+		}
+
+		// queues the pages of table drawn so far, the result is Rejected right away when the queue of priority
+		// is full. An empty filePath keeps the pdf in RenderResult::pdf
+		std::future<RenderResult> Submit(PDFTextTable& table, const std::string& filePath, RenderPriority priority, RenderOptions options = {}) {
+			auto task = std::make_shared<Task>();
+			task->job = table.PrepareRender(options);
+			task->path = filePath.empty() ? std::string() : PDFTextTable::PdfFilePath(filePath);
+			task->priority = priority;
+			task->onComplete = std::move(options.onComplete);
+			auto future = task->promise.get_future();
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				auto& queue = m_queues[static_cast<size_t>(priority)];
+				if (!m_stopping && queue.size() < m_queueLimit) {
+					task->order = m_submitted++;
+					queue.insert(task);
+					task = nullptr;
+				}
+			}
+			if (task) {
+				RenderResult result;
+				result.status = RenderStatus::Rejected;
+				Complete(*task, std::move(result));
+			}
+			else {
+				m_wake.notify_one();
+			}
+			return future;
+		}
+
+		// from Submit until the render ended, over the last renders of priority that weren't rejected
+		LatencyStats Latency(RenderPriority priority) const {
+			std::vector<long long> samples;
+			{
+				std::lock_guard<std::mutex> lock(m_statsMutex);
+				samples = m_latencies[static_cast<size_t>(priority)];
+			}
+			LatencyStats stats;
+			stats.count = samples.size();
+			if (!samples.empty()) {
+				std::sort(samples.begin(), samples.end());
+				stats.p50 = std::chrono::microseconds(samples[samples.size() / 2]);
+				stats.p99 = std::chrono::microseconds(samples[samples.size() * 99 / 100]);
+			}
+			return stats;
+		}
+
+		// the number of times a bulk render stepped aside
+		size_t Preemptions() const {
+			return m_preemptions.load();
+		}
+
+	private:
+		struct Task {
+			RenderJob job;
+			std::string path;
+			RenderPriority priority = RenderPriority::Bulk;
+			std::function<void(const RenderResult&)> onComplete;
+			std::promise<RenderResult> promise;
+			size_t order = 0;
+			// the slices of a bulk render done so far, and when the first one started
+			std::vector<lxd::ProcessResult> pdfs;
+			size_t nextPage = 0;
+			std::optional<std::chrono::steady_clock::time_point> begin;
+		};
+
+		struct Earlier {
+			bool operator()(const std::shared_ptr<Task>& a, const std::shared_ptr<Task>& b) const {
+				return std::tie(a->job.deadline, a->order) < std::tie(b->job.deadline, b->order);
+			}
+		};
+
+		void Work() {
+			while (true) {
+				std::shared_ptr<Task> task;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					auto waiting = [this]() {
+						return std::find_if(m_queues.begin(), m_queues.end(), [](const Queue& queue) { return !queue.empty(); });
+					};
+					m_wake.wait(lock, [&]() { return m_stopping || waiting() != m_queues.end(); });
+					auto queue = waiting();
+					if (queue == m_queues.end()) {
+						return;
+					}
+					task = *queue->begin();
+					queue->erase(queue->begin());
+				}
+				Run(task);
+			}
+		}
+
+		void Run(const std::shared_ptr<Task>& task) {
+			auto& job = task->job;
+			if (task->priority == RenderPriority::Interactive || job.scripts.size() <= m_slicePages) {
+				Complete(*task, RenderDocument(job, task->path));
+				return;
+			}
+
+			auto now = std::chrono::steady_clock::now();
+			if (!task->begin) {
+				task->begin = now;
+			}
+			RenderResult result;
+			result.pages = job.scripts.size();
+			result.queued = std::chrono::duration_cast<std::chrono::microseconds>(*task->begin - job.start);
+			auto finish = [&](RenderStatus status) {
+				result.status = status;
+				result.rendering = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - *task->begin);
+				Complete(*task, std::move(result));
+			};
+
+			while (task->nextPage < job.scripts.size()) {
+				if (job.stop.stop_requested()) {
+					return finish(RenderStatus::Cancelled);
+				}
+				if (std::chrono::steady_clock::now() >= job.deadline) {
+					return finish(RenderStatus::TimedOut);
+				}
+				auto first = task->nextPage, count = std::min(m_slicePages, job.scripts.size() - first);
+				task->pdfs.push_back(RenderPages(job, first, std::span(job.scripts).subspan(first, count)));
+				task->nextPage += count;
+				if (task->pdfs.back().exitCode != 0) {
+					// FinishDocument tells why
+					break;
+				}
+
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (task->nextPage < job.scripts.size() && !m_queues[static_cast<size_t>(RenderPriority::Interactive)].empty()) {
+					m_preemptions++;
+					m_queues[static_cast<size_t>(RenderPriority::Bulk)].insert(task);
+					return;
+				}
+			}
+			finish(FinishDocument(job, task->pdfs, task->path, result));
+		}
+
+		void Complete(Task& task, RenderResult result) {
+			if (result.status != RenderStatus::Rejected) {
+				auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - task.job.start);
+				std::lock_guard<std::mutex> lock(m_statsMutex);
+				auto& samples = m_latencies[static_cast<size_t>(task.priority)];
+				auto& recorded = m_recorded[static_cast<size_t>(task.priority)];
+				if (samples.size() < LATENCY_SAMPLES) {
+					samples.push_back(latency.count());
+				}
+				else {
+					samples[recorded % LATENCY_SAMPLES] = latency.count();
+				}
+				recorded++;
+			}
+			if (task.onComplete) {
+				task.onComplete(result);
+			}
+			task.promise.set_value(std::move(result));
+		}
+
 	private:
-		inline static bool m_ctxInitialized = false;
+		using Queue = std::set<std::shared_ptr<Task>, Earlier>;
+		static constexpr size_t PRIORITIES = 2;
+		static constexpr size_t LATENCY_SAMPLES = 4096;
+
+		size_t m_queueLimit;
+		size_t m_slicePages;
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::array<Queue, PRIORITIES> m_queues;
+		size_t m_submitted = 0;
+		bool m_stopping = false;
+		std::atomic<size_t> m_preemptions{};
+		mutable std::mutex m_statsMutex;
+		std::array<std::vector<long long>, PRIORITIES> m_latencies;
+		std::array<size_t, PRIORITIES> m_recorded{};
+		std::vector<std::thread> m_threads;
 	};
 
 	void PDFTest2() {
@@ -1329,9 +4755,460 @@ namespace pdf {
 
 		table.GeneratePDF("CaptionFile");
 	}
+
+	void PDFTest4() {
+		PDFTextTable table("TableCaption.txt");
+		cxxtimer::Timer timer;
+
+		Table schedule(table.GetNextLine(), 10.0);
+		schedule.AddColumn(Table::Width::Fixed, 40.0, ALIGNMENT::CENTER)
+			.AddColumn(Table::Width::Auto)
+			.AddColumn(Table::Width::Proportional, 1.0)
+			.AddColumn(Table::Width::Proportional, 2.0)
+			.SetHeaderRows(1)
+			.AddRow({ L"FDI", L"Attachment", L"Steps", L"Notes" });
+		for (int i = 0; i < 2000; i++) {
+			schedule.AddRow({ std::to_wstring(11 + i % 8), L"Attachment " + std::to_wstring(i % 32),
+				fmt::format(L"{} - {}", i % 20, i % 20 + 5), L"Attachment placed on the buccal surface" });
+		}
+
+		timer.start();
+		table.Draw(schedule);
+		timer.stop();
+		std::cout << "Table takes: " << timer.count<std::chrono::milliseconds>() << " milliseconds." << std::endl;
+
+		table.GeneratePDF("TableFile");
+	}
+
+	// Per-primitive serialization cost of the compile-time operator templates, against the same operators
+	// formatted through runtime parsed fmt format strings
+	void PDFTest5() {
+		const int count = 100000;
+		cxxtimer::Timer timer;
+		std::pmr::string out;
+
+		auto measure = [&](const char* name, auto&& record, auto&& reference) {
+			DisplayList list;
+			for (int i = 0; i < count; i++)
+				record(list, static_cast<float>(i % 600) + 0.25f);
+
+			out.clear();
+			timer.start();
+			ScriptWriter::Write(list, out);
+			timer.stop();
+			auto templated = timer.count<std::chrono::nanoseconds>() / count;
+			timer.reset();
+
+			out.clear();
+			timer.start();
+			for (int i = 0; i < count; i++)
+				reference(out, static_cast<float>(i % 600) + 0.25f);
+			timer.stop();
+			auto runtime = timer.count<std::chrono::nanoseconds>() / count;
+			timer.reset();
+
+			std::cout << name << ": " << templated << " ns templated, " << runtime << " ns runtime format" << std::endl;
+		};
+
+		const Color3 color = { 0.572f, 0.815f, 0.313f };
+
+		measure("rect", [&](DisplayList& list, float v) { list.RecordRect(Paint::Fill, 0.0, color, { v, v }, { 20.0, 10.0 }); },
+			[&](std::pmr::string& out, float v) {
+				fmt::format_to(std::back_inserter(out), fmt::runtime("% Draw a rect\r\nq {} {} {} rg {} {} {} {} re f Q\r\n"), color.x, color.y, color.z, v, v, 20.0f, 10.0f);
+			});
+
+		measure("line", [&](DisplayList& list, float v) { list.RecordLine(1.0, color, { 50.0, v }, { 657.0, v }); },
+			[&](std::pmr::string& out, float v) {
+				fmt::format_to(std::back_inserter(out), fmt::runtime("% Draw a line\r\nq {} {} {} RG {} {} m {} {} l {} w S Q\r\n"), color.x, color.y, color.z, 50.0f, v, 657.0f, v, 1.0f);
+			});
+
+		measure("text run", [&](DisplayList& list, float v) { list.RecordText(Font::TmRm, 12.0, { v, v }, 0.0, "Attachment", false); },
+			[&](std::pmr::string& out, float v) {
+				fmt::format_to(std::back_inserter(out), fmt::runtime("BT /{} {} Tf 1 0 0 1 {} {} Tm {} {} ({}) \" ET\r\n"), "TmRm", 12.0f, v, v, 0, 0.0f, "Attachment");
+			});
+
+		measure("circle", [&](DisplayList& list, float v) { Circle({ v, v }, 3.0, color).Record(list); },
+			[&](std::pmr::string& out, float v) {
+				auto r = 3.0f, ofs = 3.0f * 0.553f, y = PDF_HEIGHT - v;
+				fmt::format_to(std::back_inserter(out), fmt::runtime("% Draw a path\r\nq {} w {} {} {} rg\r\n{} {} m\r\n"), 0.01f, color.x, color.y, color.z, v, y);
+				fmt::format_to(std::back_inserter(out), fmt::runtime("{} {} {} {} {} {} c\r\n"), v, y + ofs, v + r - ofs, y + r, v + r, y + r);
+				fmt::format_to(std::back_inserter(out), fmt::runtime("{} {} {} {} {} {} c\r\n"), v + r + ofs, y + r, v + 2 * r, y + ofs, v + 2 * r, y);
+				fmt::format_to(std::back_inserter(out), fmt::runtime("{} {} {} {} {} {} c\r\n"), v + 2 * r, y - ofs, v + r + ofs, y - r, v + r, y - r);
+				fmt::format_to(std::back_inserter(out), fmt::runtime("{} {} {} {} {} {} c\r\nh\r\nf Q\r\n"), v + r - ofs, y - r, v, y - ofs, v, y);
+			});
+	}
+
+	// A grid-heavy page: one component per primitive against a Batch, recorded and written
+	void PDFTest6() {
+		const int count = 100000;
+		const Color3 color = { 0.572f, 0.815f, 0.313f };
+		cxxtimer::Timer timer;
+		std::pmr::string out;
+
+		auto measure = [&](const char* name, auto&& record) {
+			DisplayList list;
+			out.clear();
+			timer.start();
+			record(list);
+			ScriptWriter::Write(list, out);
+			timer.stop();
+			std::cout << name << ": " << timer.count<std::chrono::nanoseconds>() / count << " ns, " << out.size() / count << " bytes per primitive" << std::endl;
+			timer.reset();
+		};
+		auto position = [](int i) { return Vector2{ 50.0f + (i % 60) * 10.0f, 50.0f + (i / 60 % 90) * 10.0f }; };
+
+		measure("rects", [&](DisplayList& list) {
+			for (int i = 0; i < count; i++)
+				Rect(position(i), { 8.0, 8.0 }, color, Rect::Type::Block).Record(list);
+		});
+		measure("rect batch", [&](DisplayList& list) {
+			Batch batch(Shape::Rect, Paint::Fill, color);
+			batch.Reserve(count);
+			for (int i = 0; i < count; i++)
+				batch.AddRect(position(i), { 8.0, 8.0 });
+			batch.Record(list);
+		});
+
+		measure("lines", [&](DisplayList& list) {
+			for (int i = 0; i < count; i++)
+				Streak(position(i), { position(i).x + 8.0f, position(i).y }, color).Record(list);
+		});
+		measure("line batch", [&](DisplayList& list) {
+			Batch batch(Shape::Line, Paint::Stroke, color);
+			batch.Reserve(count);
+			for (int i = 0; i < count; i++)
+				batch.AddLine(position(i), { position(i).x + 8.0f, position(i).y });
+			batch.Record(list);
+		});
+
+		measure("circles", [&](DisplayList& list) {
+			for (int i = 0; i < count; i++)
+				Circle(position(i), 3.0, color).Record(list);
+		});
+		measure("circle batch", [&](DisplayList& list) {
+			Batch batch(Shape::Circle, Paint::Fill, color);
+			batch.Reserve(count);
+			for (int i = 0; i < count; i++)
+				batch.AddCircle({ position(i).x + 3.0f, position(i).y }, 3.0);
+			batch.Record(list);
+		});
+	}
+
+	// A template page whose optional sections are pushed off the page, written with and without culling
+	void PDFTest7() {
+		const int sections = 1000;
+		const Color3 color = { 0.572f, 0.815f, 0.313f };
+		cxxtimer::Timer timer;
+		std::pmr::string out;
+
+		DisplayList list;
+		for (int i = 0; i < sections; i++) {
+			// every other section ends up below the page, the last ones inside a clip they miss
+			float y = (i % 2) ? -200.0f - i : 900.0f - (i % 90) * 10.0f;
+			if (i >= sections - 10)
+				list.PushClip({ 0.0, 0.0 }, { 100.0, 100.0 });
+			list.RecordRect(Paint::Fill, 0.0, color, { 50.0, y }, { 607.0, 8.0 });
+			list.RecordText(Font::TmRm, 10.0, { 60.0, y }, 0.0, "Optional section with a caption", false);
+			list.RecordLine(1.0, color, { 50.0, y }, { 657.0, y });
+			if (i >= sections - 10)
+				list.Pop();
+		}
+
+		timer.start();
+		ScriptWriter::Write(list, out);
+		timer.stop();
+		std::cout << "unculled: " << timer.count<std::chrono::microseconds>() << " us, " << out.size() << " bytes" << std::endl;
+		timer.reset();
+
+		CullStats stats;
+		out.clear();
+		timer.start();
+		ScriptWriter::Write(list, out, PDF_OPERAND_PRECISION, PDF_PAGE_BOX, stats);
+		timer.stop();
+		std::cout << "culled: " << timer.count<std::chrono::microseconds>() << " us, " << out.size() << " bytes, "
+			<< stats.commands << " commands culled, " << stats.textRuns << " of them text runs" << std::endl;
+	}
+
+	// Documents laid out and rendered on threads of their own at once. They share nothing mutable,
+	// built with -fsanitize=thread this runs without a report
+	void PDFTest8() {
+		const int documents = 8;
+		std::vector<std::thread> threads;
+		for (int d = 0; d < documents; d++) {
+			threads.emplace_back([d]() {
+				PDFTextTable table(fmt::format("Concurrent{}.txt", d));
+				Table schedule(table.GetNextLine(), 10.0);
+				schedule.AddColumn(Table::Width::Fixed, 40.0, ALIGNMENT::CENTER).AddColumn(Table::Width::Auto)
+					.AddColumn(Table::Width::Proportional, 1.0).SetHeaderRows(1).AddRow({ L"FDI", L"Attachment", L"Notes" });
+				for (int i = 0; i < 200; i++)
+					schedule.AddRow({ std::to_wstring(11 + i % 8), L"Attachment " + std::to_wstring(i % 32), L"Attachment placed on the buccal surface" });
+				table.Draw(schedule);
+
+				std::vector<LayoutItem> notes;
+				for (int i = 0; i < 20; i++)
+					notes.push_back(Text(fmt::format(L"Note {} of document {}", i, d), 12.0));
+				table.DrawBatch(std::move(notes));
+
+				auto result = table.GeneratePDFAsync(fmt::format("Concurrent{}", d)).get();
+				std::cout << fmt::format("document {}: status {}, {} components, {} pages, {} bytes\n",
+					d, static_cast<int>(result.status), table.GetComponentCount(), result.pages, result.bytes);
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+	}
+
+	// A night's worth of reports in one process instead of one process per report
+	void PDFTest9() {
+		const int reports = 200;
+		std::vector<ReportJob> jobs;
+		for (int r = 0; r < reports; r++) {
+			jobs.push_back({ fmt::format("Patient{}.txt", r), fmt::format("Patient{}", r), [r](PDFTextTable& table) {
+				Table schedule(table.GetNextLine(), 10.0);
+				schedule.AddColumn(Table::Width::Fixed, 40.0, ALIGNMENT::CENTER).AddColumn(Table::Width::Auto)
+					.AddColumn(Table::Width::Proportional, 1.0).SetHeaderRows(1).AddRow({ L"FDI", L"Attachment", L"Notes" });
+				for (int i = 0; i < 40; i++)
+					schedule.AddRow({ std::to_wstring(11 + i % 8), L"Attachment " + std::to_wstring(i % 32), L"Attachment placed on the buccal surface" });
+				table.Draw(schedule);
+				std::vector<LayoutItem> notes;
+				notes.push_back(Text(fmt::format(L"Patient {}", r), 12.0));
+				table.DrawBatch(std::move(notes));
+			} });
+		}
+
+		auto batch = GenerateReports(jobs);
+		std::cout << fmt::format("{} of {} reports in {} ms on {} threads, {:.1f} documents/s\n", batch.done, reports,
+			batch.elapsed.count() / 1000, GetThreadPool().size(), batch.DocumentsPerSecond());
+	}
+
+#ifndef _WIN32
+	// One page reports from a warm server, the round trips as a local client sees them
+	void PDFTest10() {
+		auto path = UniqueTempPath("reports.sock").string();
+		ReportServer server(path);
+		server.Register("chart", [](PDFTextTable& table, std::string_view patient) {
+			Table schedule(table.GetNextLine(), 10.0);
+			schedule.AddColumn(Table::Width::Fixed, 40.0, ALIGNMENT::CENTER).AddColumn(Table::Width::Auto)
+				.AddColumn(Table::Width::Proportional, 1.0).SetHeaderRows(1).AddRow({ L"FDI", L"Attachment", L"Notes" });
+			for (int i = 0; i < 10; i++)
+				schedule.AddRow({ std::to_wstring(11 + i % 8), L"Attachment " + std::to_wstring(i), Utf8ToUnicode(patient) });
+			table.Draw(schedule);
+		});
+		std::thread serving([&server]() { server.Run(); });
+
+		const int requests = 200;
+		ReportClient client(path);
+		std::vector<long long> latencies;
+		auto begin = std::chrono::steady_clock::now();
+		for (int r = 0; r < requests && client.IsConnected(); r++) {
+			auto result = client.Render("chart", fmt::format("Patient {}", r));
+			if (result.status == RenderStatus::Done)
+				latencies.push_back(result.rendering.count());
+		}
+		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin);
+		server.Stop();
+		serving.join();
+
+		std::sort(latencies.begin(), latencies.end());
+		if (latencies.empty()) {
+			std::cout << "no report rendered" << std::endl;
+			return;
+		}
+		std::cout << fmt::format("{} of {} reports, {:.1f} reports/s, p50 {} us, p99 {} us\n", latencies.size(), requests,
+			latencies.size() * 1e6 / elapsed.count(), latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100]);
+	}
+#endif
+
+	// Charts printed while a bulk export is running, they get past the export a slice at a time
+	void PDFTest11() {
+		auto draw = [](PDFTextTable& table, int rows) {
+			Table schedule(table.GetNextLine(), 10.0);
+			schedule.AddColumn(Table::Width::Fixed, 40.0, ALIGNMENT::CENTER).AddColumn(Table::Width::Auto)
+				.AddColumn(Table::Width::Proportional, 1.0).SetHeaderRows(1).AddRow({ L"FDI", L"Attachment", L"Notes" });
+			for (int i = 0; i < rows; i++)
+				schedule.AddRow({ std::to_wstring(11 + i % 8), L"Attachment " + std::to_wstring(i % 32), L"Attachment placed on the buccal surface" });
+			table.Draw(schedule);
+		};
+
+		RenderScheduler scheduler;
+		std::vector<std::future<RenderResult>> renders;
+		for (int d = 0; d < 8; d++) {
+			PDFTextTable table(fmt::format("Export{}.txt", d));
+			draw(table, 2000);
+			renders.push_back(scheduler.Submit(table, std::string(), RenderPriority::Bulk));
+		}
+		for (int d = 0; d < 10; d++) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+			PDFTextTable table(fmt::format("Chart{}.txt", d));
+			draw(table, 10);
+			renders.push_back(scheduler.Submit(table, std::string(), RenderPriority::Interactive, { std::chrono::seconds(5) }));
+		}
+		for (auto& render : renders)
+			render.wait();
+
+		for (auto priority : { RenderPriority::Interactive, RenderPriority::Bulk }) {
+			auto stats = scheduler.Latency(priority);
+			std::cout << fmt::format("{}: {} renders, p50 {} ms, p99 {} ms\n", (priority == RenderPriority::Interactive) ? "interactive" : "bulk",
+				stats.count, stats.p50.count() / 1000, stats.p99.count() / 1000);
+		}
+		std::cout << scheduler.Preemptions() << " preemptions" << std::endl;
+	}
+
+	// Where the time of a long document goes once serializing and storing run behind layout
+	void PDFTest12() {
+		PDFTextTable table("Pipelined.txt");
+		table.SetPipeline(8);
+		Table schedule(table.GetNextLine(), 10.0);
+		schedule.AddColumn(Table::Width::Fixed, 40.0, ALIGNMENT::CENTER).AddColumn(Table::Width::Auto)
+			.AddColumn(Table::Width::Proportional, 1.0).SetHeaderRows(1).AddRow({ L"FDI", L"Attachment", L"Notes" });
+		for (int i = 0; i < 20000; i++)
+			schedule.AddRow({ std::to_wstring(11 + i % 8), L"Attachment " + std::to_wstring(i % 32), L"Attachment placed on the buccal surface" });
+		table.Draw(schedule);
+		table.GeneratePDF("Pipelined");
+
+		for (const auto& stage : table.GetPipelineStats()) {
+			std::cout << fmt::format("{}: {} pages, {:.0f}% busy, {} us starved, {} us blocked\n", stage.name, stage.pages,
+				stage.Utilisation() * 100, stage.starved.count(), stage.blocked.count());
+		}
+	}
+
+	// Reports that differ in the cover and the latest step only, every other page comes out of the cache
+	void PDFTest13() {
+		GetPageCache().SetDirectory(std::filesystem::temp_directory_path() / "pdf-page-cache");
+		auto drawStep = [](PDFTextTable& table, int step) {
+			table.DrawPage(PageKey().Add("step").Add(step), [&table, step]() {
+				Table schedule(table.GetNextLine(), 10.0);
+				schedule.AddColumn(Table::Width::Fixed, 40.0, ALIGNMENT::CENTER).AddColumn(Table::Width::Auto)
+					.AddColumn(Table::Width::Proportional, 1.0).SetHeaderRows(1).AddRow({ L"FDI", L"Attachment", L"Notes" });
+				for (int i = 0; i < 40; i++)
+					schedule.AddRow({ std::to_wstring(11 + i % 8), fmt::format(L"Step {} attachment {}", step, i), L"Attachment placed on the buccal surface" });
+				table.Draw(schedule);
+			});
+		};
+
+		cxxtimer::Timer timer;
+		for (int report = 0; report < 3; report++) {
+			timer.start();
+			PDFTextTable table(fmt::format("Cached{}.txt", report));
+			auto cover = fmt::format(L"Report {}", report);
+			table.DrawPage(PageKey().Add("cover").Add(cover), [&table, &cover]() {
+				std::vector<LayoutItem> title;
+				title.push_back(Text(cover, 24.0));
+				table.DrawBatch(std::move(title));
+			});
+			for (int step = 0; step < 30 + report; step++)
+				drawStep(table, step);
+			table.GeneratePDF(fmt::format("Cached{}", report));
+			timer.stop();
+			auto stats = GetPageCache().GetStats();
+			std::cout << fmt::format("report {}: {} us, {} hits, {} from disk, {} misses so far\n", report,
+				timer.count<std::chrono::microseconds>(), stats.hits, stats.diskHits, stats.misses);
+			timer.reset();
+		}
+	}
+
+	// Runs the render path against renderer, a stand-in for mutool taking the same arguments: the process
+	// itself, a document split over several renderer runs and merged, a pdf written to disk and a
+	// renderer that doesn't exist. False with the failed step printed if anything didn't go as expected
+	bool CheckRenderer(const std::string& renderer) {
+		auto check = [](bool ok, std::string_view step) {
+			std::cout << fmt::format("{}: {}\n", step, ok ? "ok" : "FAILED");
+			return ok;
+		};
+		bool ok = true;
+
+#ifndef _WIN32
+		std::string script = "%%MediaBox 0 0 707 1000\nBT /TmRm 12 Tf 1 0 0 1 50 900 Tm (check) Tj ET\n";
+		std::string_view inputs[] = { script, script };
+		auto process = lxd::RunProcess({ renderer, "create", "-o", "/dev/stdout" }, inputs);
+		ok &= check(process.exitCode == 0 && process.output.starts_with("%PDF") && process.output.find("/Count 2") != std::string::npos, "RunProcess");
+#endif
+
+		PDFTextTable table("Check.txt");
+		Table rows(table.GetNextLine(), 10.0);
+		rows.AddColumn(Table::Width::Auto).AddColumn(Table::Width::Proportional).SetHeaderRows(1).AddRow({ L"Step", L"Notes" });
+		for (int i = 0; i < 200; i++)
+			rows.AddRow({ std::to_wstring(i), L"Attachment placed on the buccal surface" });
+		table.Draw(rows);
+		table.SetRenderer(renderer);
+		table.SetRenderShards(3);
+		auto merged = table.RenderPDF(std::string());
+		ok &= check(merged.status == RenderStatus::Done && merged.pages > 3 &&
+			merged.pdf.find(fmt::format("/Count {} >>", merged.pages)) != std::string::npos, "RenderPDF over 3 renderer runs");
+
+		auto path = UniqueTempPath("check.pdf").string();
+		auto written = table.GeneratePDF(path);
+		std::error_code error;
+		ok &= check(written.status == RenderStatus::Done && std::filesystem::file_size(path, error) == written.bytes, "GeneratePDF");
+		std::filesystem::remove(path, error);
+
+		table.SetRenderer(renderer + ".missing");
+		ok &= check(table.RenderPDF(std::string()).status == RenderStatus::Failed, "missing renderer");
+		return ok;
+	}
+
+	// Lays out and renders documents one after another, then all of them at once on threads of their own,
+	// and expects the same pdfs. The documents share the font metrics, the image header cache, both pools
+	// and the page cache, so a build with PDF_SANITIZE_THREAD reports any race between them
+	bool CheckConcurrency(const std::string& renderer) {
+		// a 2x2 gray pgm, every document draws it and reads its header
+		auto imagePath = UniqueTempPath("check.pgm").string();
+		const char image[] = "P5 2 2 255\n\x10\x80\x80\xF0";
+		lxd::WriteFile(Utf8ToUnicode(imagePath).c_str(), image, sizeof(image) - 1);
+
+		auto render = [&](int d) {
+			PDFTextTable table(fmt::format("Concurrent{}.txt", d));
+			table.SetRenderer(renderer);
+			table.SetRenderShards(2);
+			table.DrawPage(PageKey().Add("cover").Add(d % 2), [&table, d]() {
+				table.Draw(Text(fmt::format(L"Cover {}", d % 2), 24.0, Vector2{ PDF_PADDING, PDF_PADDING + 24.0f }));
+			});
+			table.Draw(Image(imagePath, { PDF_PADDING, table.GetNextLine() + 40.0f }, 40.0));
+			Table schedule(table.GetNextLine(), 10.0);
+			schedule.AddColumn(Table::Width::Fixed, 40.0, ALIGNMENT::CENTER).AddColumn(Table::Width::Auto)
+				.AddColumn(Table::Width::Proportional, 1.0).SetHeaderRows(1).AddRow({ L"FDI", L"Attachment", L"Notes" });
+			for (int i = 0; i < 150 + 10 * d; i++)
+				schedule.AddRow({ std::to_wstring(11 + i % 8), L"Attachment " + std::to_wstring(i % 32), L"Attachment placed on the buccal surface" });
+			table.Draw(schedule);
+
+			std::vector<LayoutItem> notes;
+			for (int i = 0; i < 20; i++)
+				notes.push_back(Text(fmt::format(L"Note {} of document {}", i, d), 12.0));
+			table.DrawBatch(std::move(notes));
+			return (d % 2) ? table.GeneratePDFAsync(std::string()).get() : table.RenderPDF(std::string());
+		};
+
+		const int documents = 8;
+		std::vector<RenderResult> serial, concurrent(documents);
+		for (int d = 0; d < documents; d++)
+			serial.push_back(render(d));
+		std::vector<std::thread> threads;
+		for (int d = 0; d < documents; d++)
+			threads.emplace_back([&, d]() { concurrent[d] = render(d); });
+		for (auto& thread : threads)
+			thread.join();
+
+		std::error_code error;
+		std::filesystem::remove(imagePath, error);
+
+		bool ok = true;
+		for (int d = 0; d < documents; d++) {
+			bool same = serial[d].status == RenderStatus::Done && concurrent[d].status == RenderStatus::Done && serial[d].pdf == concurrent[d].pdf;
+			std::cout << fmt::format("document {}: {} pages, {}\n", d, concurrent[d].pages, same ? "ok" : "DIFFERS");
+			ok &= same;
+		}
+		return ok;
+	}
 }
 
-void main() {
+int main(int argc, char* argv[]) {
+	// pdf --check-renderer <renderer>, pdf --check-concurrency <renderer>
+	if (argc == 3 && std::string_view(argv[1]) == "--check-renderer")
+		return pdf::CheckRenderer(argv[2]) ? 0 : 1;
+	if (argc == 3 && std::string_view(argv[1]) == "--check-concurrency")
+		return pdf::CheckConcurrency(argv[2]) ? 0 : 1;
+
 	// pdf::ExportCaptionTable();
 	pdf::PDFTest3();
+	return 0;
 }
@@ -0,0 +1,62 @@
+// Stand-in for the pdf renderer, taking the same arguments as "mutool create -o out.pdf page...". Every
+// page script becomes one page whose content stream is the script as is, in a pdf with the classic xref
+// table mutool writes. Nothing is drawn, it is only there so the render path can be checked without mutool
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+static bool ReadAll(const char* path, std::string& data) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return false;
+	data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 5 || std::string(argv[1]) != "create" || std::string(argv[2]) != "-o") {
+		std::fprintf(stderr, "usage: %s create -o output.pdf page...\n", argv[0]);
+		return 2;
+	}
+
+	// 1 catalog, 2 page tree, 3 font, then a page and its content for every script
+	std::vector<std::string> objects = {
+		"<< /Type /Catalog /Pages 2 0 R >>",
+		"",
+		"<< /Type /Font /Subtype /Type1 /BaseFont /Times-Roman >>"
+	};
+	std::string kids;
+	for (int i = 4; i < argc; i++) {
+		std::string script;
+		if (!ReadAll(argv[i], script)) {
+			std::fprintf(stderr, "cannot read %s\n", argv[i]);
+			return 1;
+		}
+		auto page = objects.size() + 1;
+		objects.push_back("<< /Type /Page /Parent 2 0 R /Contents " + std::to_string(page + 1) + " 0 R /Resources << /Font << /TmRm 3 0 R >> >> >>");
+		objects.push_back("<< /Length " + std::to_string(script.size()) + " >>\nstream\n" + script + "\nendstream");
+		kids += " " + std::to_string(page) + " 0 R";
+	}
+	objects[1] = "<< /Type /Pages /MediaBox [0 0 707 1000] /Kids [" + kids + " ] /Count " + std::to_string(argc - 4) + " >>";
+
+	std::string pdf = "%PDF-1.7\n%\xE2\xE3\xCF\xD3\n";
+	std::vector<size_t> offsets;
+	for (size_t i = 0; i < objects.size(); i++) {
+		offsets.push_back(pdf.size());
+		pdf += std::to_string(i + 1) + " 0 obj\n" + objects[i] + "\nendobj\n";
+	}
+	auto xref = pdf.size();
+	pdf += "xref\n0 " + std::to_string(objects.size() + 1) + "\n0000000000 65535 f\r\n";
+	for (auto offset : offsets) {
+		char entry[32];
+		std::snprintf(entry, sizeof(entry), "%010zu 00000 n\r\n", offset);
+		pdf += entry;
+	}
+	pdf += "trailer\n<< /Size " + std::to_string(objects.size() + 1) + " /Root 1 0 R >>\nstartxref\n" + std::to_string(xref) + "\n%%EOF\n";
+
+	std::ofstream out(argv[3], std::ios::binary);
+	out.write(pdf.data(), pdf.size());
+	return out.good() ? 0 : 1;
+}